@@ -0,0 +1,46 @@
+#!/bin/bash
+#
+# compare the interpreter against lazy2c output on the examples
+# run from the top of the source tree after "make lazy lazy2c"
+#
+CC=${CC:-gcc}
+TMP=${TMPDIR:-/tmp}/lazybench.$$
+mkdir -p $TMP
+trap 'rm -rf $TMP' EXIT
+
+# a reasonably large text input
+i=0
+while [ $i -lt 50 ]; do
+    echo "The quick brown fox jumps over the lazy dog $i"
+    i=$((i+1))
+done > $TMP/text
+
+# name, program, input, bytes of output to keep
+set -- \
+    rot13 lazier/eg/rot13.lazy $TMP/text 0 \
+    fib lazier/eg/fib.lazy /dev/null 20000 \
+    ab lazier/eg/ab.lazy /dev/null 20000 \
+    powers2 lazier/eg/powers2.lazy /dev/null 5000 \
+    hello lazier/eg/hello.lazy /dev/null 0
+
+runtime() {
+    # prints the wall clock seconds taken by "$@"
+    local TIMEFORMAT=%R
+    { time "$@" >/dev/null 2>&1; } 2>&1
+}
+
+printf "%-10s %10s %10s\n" program lazy lazy2c
+while [ $# -gt 0 ]; do
+    name=$1 prog=$2 input=$3 keep=$4
+    shift 4
+    ./lazy2c -o $TMP/$name.c $prog || exit 1
+    $CC -g -DINTERPRETER -DHOST_TOOL -I. -o $TMP/$name $TMP/$name.c lazy.c parser.c checkpoint.c io.c || exit 1
+    if [ $keep -gt 0 ]; then
+        a=$(runtime sh -c "./lazy $prog < $input | head -c $keep")
+        b=$(runtime sh -c "$TMP/$name < $input | head -c $keep")
+    else
+        a=$(runtime ./lazy $prog < $input)
+        b=$(runtime $TMP/$name < $input)
+    fi
+    printf "%-10s %9ss %9ss\n" $name $a $b
+done
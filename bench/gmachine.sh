@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+# compare the G-machine engine (lazy -G) against plain graph
+# reduction on the examples; run from the top of the source tree
+# after "make lazy", or give another build (e.g. ./lazys, with the
+# Propeller's heap) as the argument
+#
+LAZY=${1:-./lazy}
+TMP=${TMPDIR:-/tmp}/lazybench.$$
+mkdir -p $TMP
+trap 'rm -rf $TMP' EXIT
+
+# a reasonably large text input
+i=0
+while [ $i -lt 300 ]; do
+    echo "The quick brown fox jumps over the lazy dog $i"
+    i=$((i+1))
+done > $TMP/text
+echo "1 2 + 3 * 4 5 + * 6 7 * +" > $TMP/calc
+
+# name, program, input, bytes of output to keep
+set -- \
+    rot13 lazier/eg/rot13.lazy $TMP/text 0 \
+    calc lazier/eg/calc.lazy $TMP/calc 0 \
+    fib lazier/eg/fib.lazy /dev/null 20000 \
+    ab lazier/eg/ab.lazy /dev/null 20000 \
+    powers2 lazier/eg/powers2.lazy /dev/null 5000 \
+    hello lazier/eg/hello.lazy /dev/null 0
+
+runtime() {
+    # prints the wall clock seconds taken by "$@"
+    local TIMEFORMAT=%R
+    { time "$@" >/dev/null 2>&1; } 2>&1
+}
+
+run() {
+    # run the program with options $1, keeping $keep bytes
+    if [ $keep -gt 0 ]; then
+        $LAZY $1 $prog < $input | head -c $keep
+    else
+        $LAZY $1 $prog < $input
+    fi
+}
+
+status=0
+printf "%-10s %10s %10s\n" program lazy "lazy -G"
+while [ $# -gt 0 ]; do
+    name=$1 prog=$2 input=$3 keep=$4
+    shift 4
+    run "" > $TMP/a
+    run -G > $TMP/b
+    if ! cmp -s $TMP/a $TMP/b; then
+        # (with a small heap, -G may run out of cells where lazy doesn't)
+        echo "$name: output differs with -G"
+        status=1
+        continue
+    fi
+    a=$(runtime run "")
+    b=$(runtime run -G)
+    printf "%-10s %9ss %9ss\n" $name $a $b
+done
+exit $status
@@ -0,0 +1,53 @@
+#!/bin/bash
+#
+# compare the interaction net engine (lazy -I) against plain graph
+# reduction on the examples small enough for it; run from the top of
+# the source tree after "make lazy"
+#
+TMP=${TMPDIR:-/tmp}/lazybench.$$
+mkdir -p $TMP
+trap 'rm -rf $TMP' EXIT
+
+echo "The quick brown fox" > $TMP/text
+echo "1+2*3" > $TMP/calc
+
+# name, program, input
+set -- \
+    hello lazier/eg/hello.lazy /dev/null \
+    rot13 lazier/eg/rot13.lazy $TMP/text \
+    calc lazier/eg/calc.lazy $TMP/calc \
+    unlambda lazier/eg/unlambda.lazy $TMP/calc
+
+runtime() {
+    # prints the wall clock seconds taken by "$@"
+    local TIMEFORMAT=%R
+    { time "$@" >/dev/null 2>&1; } 2>&1
+}
+
+run() {
+    ./lazy $1 $prog < $input
+}
+
+count() {
+    # the first number in what -v says, the reductions or interactions
+    ./lazy -v $1 $prog < $input 2>&1 >/dev/null | sed -n 's/^[^0-9]*\([0-9]*\).*/\1/p'
+}
+
+beta() {
+    ./lazy -v -I $prog < $input 2>&1 >/dev/null | sed -n 's/.*(\([0-9]*\) beta.*/\1/p'
+}
+
+printf "%-10s %10s %12s %10s %12s %10s\n" program lazy reductions "lazy -I" interactions beta
+while [ $# -gt 0 ]; do
+    name=$1 prog=$2 input=$3
+    shift 3
+    run "" > $TMP/a
+    run -I > $TMP/b
+    if ! cmp -s $TMP/a $TMP/b; then
+        echo "$name: output differs with -I"
+        exit 1
+    fi
+    a=$(runtime run "")
+    b=$(runtime run -I)
+    printf "%-10s %9ss %12s %9ss %12s %10s\n" $name $a $(count "") $b $(count -I) $(beta)
+done
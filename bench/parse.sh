@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# time parsing with optimizer pattern tables of increasing size
+# run from the top of the source tree after "make lazy"
+#
+TMP=${TMPDIR:-/tmp}/lazybench.$$
+mkdir -p $TMP
+trap 'rm -rf $TMP' EXIT
+
+LEAVES=${LEAVES:-200000}
+
+# a pattern table of n entries: ``s``s`ksk[i] (the successor of i)
+# is [i+1]
+table() {
+    awk -v n=$1 'BEGIN { for (i = 0; i < n; i++) print "``s``s`ksk[" i "] [" i+1 "]" }'
+}
+
+# a program that ignores a large random term and prints nothing;
+# the term mixes plain combinators, successors of numbers (about
+# half of them in the larger tables) and some of the builtin patterns
+awk -v leaves=$LEAVES '
+function leaf(r) {
+    r = int(rand() * 8)
+    if (r < 3) printf "%s", substr("ski", r+1, 1)
+    else if (r < 7) printf "``s``s`ksk[%d]", int(rand() * 200000)
+    else printf "``s``s`kski"
+    if (++count % 8 == 0) printf "\n"
+}
+function tree(n) {
+    if (n == 1) { leaf(); return }
+    printf "`"
+    tree(int(n/2))
+    tree(n - int(n/2))
+}
+BEGIN {
+    srand(1)
+    print "``k`k``c[256][256]"
+    tree(leaves)
+    print ""
+}' > $TMP/big.lazy
+./lazy $TMP/big.lazy || exit 1
+
+runtime() {
+    # prints the wall clock seconds taken by "$@"
+    local TIMEFORMAT=%R
+    { time "$@" >/dev/null 2>&1; } 2>&1
+}
+
+printf "%-10s %10s\n" patterns parse
+# the plain parser, then -p, which turns the patterns on without the
+# reduction -O adds; 0 extra patterns is just the builtin ones
+printf "%-10s %9ss\n" none $(runtime ./lazy $TMP/big.lazy)
+for n in 0 1000 10000 100000; do
+    table $n > $TMP/table
+    printf "%-10s %9ss\n" $((n+8)) $(runtime ./lazy -p $TMP/table $TMP/big.lazy)
+done
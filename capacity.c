@@ -0,0 +1,285 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// capacity planning for the host interpreter
+//
+// lazys only tells us whether a program fits in the Propeller's
+// memory or not. Here we run a program on one input many times, each
+// time in a fork with heap_end and root_limit lowered, and binary
+// search for the smallest heap and root stack that it finishes with.
+// Running out of either is fatal, so a run that doesn't fit just
+// dies; one that finishes sends its statistics back through a pipe.
+//
+// A run also counts as failing if its output differs from that of the
+// run with the whole heap, or if it takes more than SLOWDOWN times as
+// long: with a heap only just big enough the gc runs every few
+// allocations, and the program may as well not finish.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "lazy.h"
+
+#ifdef _WIN32
+
+int plan_capacity(const char *prog, bool optimize, bool gmachine)
+{
+    fatal("capacity planning is not supported on this platform");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define SLOWDOWN 10
+
+// the heap sizes we show the gc overhead for, in quarters of the
+// smallest one
+static const int heap_quarters[] = { 4, 5, 6, 8, 16, 32 };
+
+// what a run found
+typedef struct trial {
+    bool ok;
+    unsigned long reductions;
+    unsigned long gcs;
+    unsigned long peak_live;
+    unsigned long sum_live;   // of the cells live after each gc
+    int peak_roots;
+    unsigned long outlen;
+    uint32_t outhash;
+    double secs;
+} Trial;
+
+static const char *prog_text;
+static bool prog_optimize, prog_gmachine;
+
+static unsigned char *input;
+static size_t inlen;
+static unsigned long outlen;
+static uint32_t outhash;
+static unsigned long sum_live;
+
+// the output is only hashed (FNV-1a), to compare runs
+static void
+hash_write(LazyIO *io, const unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        outhash = (outhash ^ buf[i]) * 16777619u;
+    }
+    outlen += len;
+}
+
+// called at the start of each gc; gl_live is from the one before
+static void
+note_live(void)
+{
+    if (gl_gcs > 0) {
+        sum_live += gl_live;
+    }
+}
+
+//
+// run the program with a heap of cells cells and a root stack of
+// roots entries, giving up after timeout seconds (if not 0)
+//
+static Trial
+run(unsigned long cells, int roots, double timeout)
+{
+    Trial T = { 0 };
+    int fds[2];
+    int status;
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        double start;
+
+        close(fds[0]);
+        // fatal() writes to stdout
+        if (!freopen("/dev/null", "w", stdout)) _exit(1);
+        if (timeout > 0) {
+            struct itimerval it = { { 0, 0 }, { 0, 0 } };
+            it.it_value.tv_sec = (long)timeout;
+            it.it_value.tv_usec = (long)((timeout - (long)timeout) * 1e6);
+            setitimer(ITIMER_REAL, &it, NULL);
+        }
+        heap_end = &mem[cells];
+        root_limit = roots;
+        gl_io = io_memory(input, inlen);
+        gl_io->write = hash_write;
+        gl_gc_hook = note_live;
+        start = job_clock();
+        g_root = load_program(prog_text, prog_optimize, prog_gmachine);
+        eval_loop();
+        T.secs = job_clock() - start;
+        T.ok = true;
+        T.reductions = gl_reductions;
+        T.gcs = gl_gcs;
+        T.peak_live = gl_peak_live;
+        T.sum_live = sum_live + (gl_gcs > 0 ? gl_live : 0);
+        T.peak_roots = gl_peak_roots;
+        T.outlen = outlen;
+        T.outhash = outhash;
+        // small enough for the pipe to take in one go
+        if (write(fds[1], &T, sizeof(T)) != sizeof(T)) _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    if (read(fds[0], &T, sizeof(T)) != sizeof(T)) {
+        T.ok = false;
+    }
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        T.ok = false;
+    }
+    return T;
+}
+
+static bool
+same_run(Trial *T, Trial *base)
+{
+    return T->ok && T->outlen == base->outlen && T->outhash == base->outhash;
+}
+
+static void
+show_run(unsigned long cells, Trial *T, Trial *base)
+{
+    if (T->gcs) {
+        printf("%9lu %8lu %10lu %10lu", cells, T->gcs,
+               T->sum_live / T->gcs, T->peak_live);
+    } else {
+        printf("%9lu %8d %10s %10s", cells, 0, "-", "-");
+    }
+    printf(" %8.3fs", T->secs);
+    if (base->secs > 0) {
+        printf(" %+7.0f%%", 100.0 * (T->secs - base->secs) / base->secs);
+    }
+    printf("\n");
+}
+
+int
+plan_capacity(const char *prog, bool optimize, bool gmachine)
+{
+    Trial base, T, best;
+    unsigned long lo, hi, mid, cells, min_cells;
+    int rlo, rhi, rmid, min_roots;
+    double timeout;
+    unsigned i;
+    unsigned long addressable = (1 << 14) - PROPELLER_MEM_ADDR / 4;
+
+    prog_text = prog;
+    prog_optimize = optimize;
+    prog_gmachine = gmachine;
+    // size the program as the Propeller would run it
+    gl_host_passes = false;
+    input = io_read_all(stdin, &inlen);
+
+    base = run(NUMCELLS, ROOT_STACK_SIZE, 0);
+    if (!base.ok) {
+        printf("the program does not finish with %lu cells and %d roots\n",
+               (unsigned long)NUMCELLS, ROOT_STACK_SIZE);
+        return 1;
+    }
+    printf("input %lu bytes, output %lu bytes, %lu reductions, %.3fs\n",
+           (unsigned long)inlen, base.outlen, base.reductions, base.secs);
+    timeout = SLOWDOWN * base.secs + 1.0;
+
+    // the smallest heap
+    best = base;
+    lo = 0;
+    hi = NUMCELLS;
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        T = run(mid, ROOT_STACK_SIZE, timeout);
+        if (same_run(&T, &base)) {
+            hi = mid;
+            best = T;
+        } else {
+            lo = mid;
+        }
+    }
+    min_cells = hi;
+    printf("smallest heap: %lu cells (peak live %lu)\n", min_cells, best.peak_live);
+
+    // the smallest root stack, which can't be deeper than it got
+    rlo = 0;
+    rhi = base.peak_roots;
+    while (rhi - rlo > 1) {
+        rmid = rlo + (rhi - rlo) / 2;
+        T = run(NUMCELLS, rmid, timeout);
+        if (same_run(&T, &base)) {
+            rhi = rmid;
+        } else {
+            rlo = rmid;
+        }
+    }
+    min_roots = rhi;
+    printf("smallest root stack: %d entries\n", min_roots);
+
+    printf("\n%9s %8s %10s %10s %9s %8s\n",
+           "heap", "gcs", "mean live", "peak live", "time", "vs. full");
+    for (i = 0; i < sizeof(heap_quarters) / sizeof(heap_quarters[0]); i++) {
+        cells = min_cells * heap_quarters[i] / 4;
+        if (cells >= NUMCELLS) break;
+        T = (i == 0) ? best : run(cells, ROOT_STACK_SIZE, timeout);
+        if (!same_run(&T, &base)) {
+            printf("%9lu   (did not finish)\n", cells);
+            continue;
+        }
+        show_run(cells, &T, &base);
+    }
+    show_run(NUMCELLS, &base, &base);
+
+    printf("\nPropeller: %s its %d cells and %d root stack entries\n",
+           (min_cells <= PROPELLER_NUMCELLS && min_roots <= PROPELLER_ROOT_STACK)
+           ? "fits in" : "does not fit in",
+           PROPELLER_NUMCELLS, PROPELLER_ROOT_STACK);
+    printf("14 bit cell pointers: %s the %lu cells they can address\n",
+           min_cells <= addressable ? "fits in" : "does not fit in", addressable);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,235 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// heap checkpoint and restore
+//
+// A checkpoint is a header followed by the raw cells below heap_top.
+// Reductions only ever overwrite an apply node with something
+// equivalent, so the graph hanging off g_root is a complete
+// description of the computation at any point between reductions;
+// on restore we just start eval_loop again from g_root. The C stack
+// can't be saved, so the temporaries on the root stack are dropped
+// (the gc below frees them) rather than written out.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lazy.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#define CKPT_MAGIC "LAZYCKP3"
+// cells start on a page boundary in the file, so they can be mmap'd
+#define CKPT_ALIGN 4096
+
+typedef struct ckpt_header {
+    char magic[8];
+    uint32_t cellsize;
+    uint32_t numcells;
+    uint64_t ncells;      // cells in use (heap_top - mem)
+    uint64_t membase;     // where mem was when the checkpoint was taken
+    uint64_t funcbase;    // and where K_func was
+    uint64_t root;
+    uint64_t freelist;
+    uint64_t reductions;
+    uint64_t programend;  // cells of the program itself, for -M
+    uint64_t inputread;   // bytes of input the graph has already seen
+} CkptHeader;
+
+const char *gl_checkpoint_file;
+unsigned long gl_checkpoint_at;
+unsigned long gl_input_read, gl_input_skip;
+
+void
+checkpoint_write(const char *fname)
+{
+    CkptHeader H;
+    FILE *f;
+    size_t n;
+    static char pad[CKPT_ALIGN];
+
+    // whatever output the prologue produced belongs to this run
+    io_flush(gl_io);
+    fflush(stdout);
+
+    // we are not going to return to whoever pushed the roots,
+    // so only g_root is live
+    root_stack_top = 0;
+    gc();
+
+    memset(&H, 0, sizeof(H));
+    memcpy(H.magic, CKPT_MAGIC, sizeof(H.magic));
+    H.cellsize = sizeof(Cell);
+    H.numcells = NUMCELLS;
+    H.ncells = heap_top - &mem[0];
+    H.membase = (uintptr_t)&mem[0];
+    H.funcbase = (uintptr_t)&K_func;
+    H.root = (uintptr_t)g_root;
+    H.freelist = (uintptr_t)free_list;
+    H.reductions = gl_reductions;
+#ifndef HOST_TOOL
+    H.programend = gl_program_end - &mem[0];
+#endif
+    // anything read ahead into gl_io is dropped with it; a resumed
+    // run is given the same input, and skips what was used
+    H.inputread = gl_input_read;
+
+    f = fopen(fname, "wb");
+    if (!f) {
+        perror(fname);
+        exit(1);
+    }
+    n = fwrite(&H, sizeof(H), 1, f);
+    n += fwrite(pad, CKPT_ALIGN - sizeof(H), 1, f);
+    n += fwrite(mem, sizeof(Cell), H.ncells, f);
+    if (n != H.ncells + 2 || fclose(f) != 0) {
+        perror(fname);
+        exit(1);
+    }
+    fprintf(stderr, "checkpoint: %lu cells after %lu reductions written to %s\n",
+            (unsigned long)H.ncells, gl_reductions, fname);
+    exit(0);
+}
+
+//
+// fix up pointers if mem or the code moved since the checkpoint
+// was taken (e.g. because of address space randomization)
+//
+static Cell *
+reloc(Cell *c, intptr_t delta)
+{
+    return c ? (Cell *)((char *)c + delta) : c;
+}
+
+static void
+relocate(size_t ncells, intptr_t delta, intptr_t fdelta)
+{
+    size_t i;
+    Cell *c;
+
+    for (i = 0; i < ncells; i++) {
+        c = &mem[i];
+        switch (gettype(c)) {
+        case CT_FREE:
+        case CT_A_PAIR:
+        case CT_S2_PAIR:
+        case CT_C2_PAIR:
+        case CT_NUM_PAIR:
+            if (delta) {
+                setleft(c, reloc(getleft(c), delta));
+                setright(c, reloc(getright(c), delta));
+            }
+            break;
+        case CT_FUNC:
+            if (fdelta) {
+                setfunc(c, (CellFunc *)((char *)getfunc(c) + fdelta));
+            }
+            if (delta) {
+                setarg(c, reloc(getarg(c), delta));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void
+checkpoint_restore(const char *fname)
+{
+    CkptHeader H;
+    FILE *f;
+    intptr_t delta, fdelta;
+
+    f = fopen(fname, "rb");
+    if (!f) {
+        perror(fname);
+        exit(1);
+    }
+    if (fread(&H, sizeof(H), 1, f) != 1
+        || memcmp(H.magic, CKPT_MAGIC, sizeof(H.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a checkpoint file\n", fname);
+        exit(1);
+    }
+    if (H.cellsize != sizeof(Cell) || H.numcells != NUMCELLS) {
+        fprintf(stderr, "%s: checkpoint was made by a different interpreter\n", fname);
+        exit(1);
+    }
+#ifdef _WIN32
+    if (fseek(f, CKPT_ALIGN, SEEK_SET) != 0
+        || fread(mem, sizeof(Cell), H.ncells, f) != H.ncells)
+    {
+        fprintf(stderr, "%s: short checkpoint file\n", fname);
+        exit(1);
+    }
+#else
+    // map the whole pages privately, so that the ones we never write
+    // stay shared with the page cache; the partial page at the end
+    // would map past the end of mem, so read that one instead
+    {
+        size_t len = H.ncells * sizeof(Cell);
+        size_t full = len & ~(size_t)(CKPT_ALIGN-1);
+        if (full > 0
+            && mmap(mem, full, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED,
+                    fileno(f), CKPT_ALIGN) == MAP_FAILED)
+        {
+            perror(fname);
+            exit(1);
+        }
+        if (len > full
+            && pread(fileno(f), (char *)mem + full, len - full, CKPT_ALIGN + full)
+               != (ssize_t)(len - full))
+        {
+            fprintf(stderr, "%s: short checkpoint file\n", fname);
+            exit(1);
+        }
+    }
+#endif
+    fclose(f);
+
+    delta = (intptr_t)((uintptr_t)&mem[0] - H.membase);
+    fdelta = (intptr_t)((uintptr_t)&K_func - H.funcbase);
+    if (delta || fdelta) {
+        relocate(H.ncells, delta, fdelta);
+    }
+    heap_top = &mem[H.ncells];
+    free_list = reloc((Cell *)(uintptr_t)H.freelist, delta);
+    g_root = reloc((Cell *)(uintptr_t)H.root, delta);
+    gl_reductions = H.reductions;
+#ifndef HOST_TOOL
+    gl_program_end = &mem[H.programend];
+#endif
+    gl_input_skip = H.inputread;
+}
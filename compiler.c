@@ -35,15 +35,11 @@
 #define SMALL
 #include <stdint.h>
 #include "lazy.h"
-#include "runtime_bin.h"
+#include "propimage.h"
 
 //#define DEBUG_COMPILER
 
 Cell mem[NUMCELLS];
-// shifts to extract left/right nodes from a cell
-#define LHS_SHIFT 4
-#define RHS_SHIFT 18
-
 
 uint32_t
 convertCellAddr(Cell *c)
@@ -59,7 +55,6 @@ convertCellAddr(Cell *c)
     fatal("Unable to convert cell address!");
 }
 
-#include "fnmap.h"
 uint32_t
 convertCellFunc(CellFunc *f)
 {
@@ -74,9 +69,6 @@ convertCellFunc(CellFunc *f)
     return 0;
 }
 
-// convert Propeller address to 14 bits
-#define ADDR(x) (((x)>>2) & 0x3fff)
-
 uint32_t
 buildpair(uint32_t left, uint32_t right)
 {
@@ -104,7 +96,7 @@ convertCell(Cell *x)
         c |= buildpair(left, right);
         break;
     case CT_NUM:
-        c |= (getnum(x) << 4);
+        c |= (getnum(x) << NUM_SHIFT);
         break;
     case CT_FUNC:
         left = ADDR(convertCellFunc(getfunc(x)));
@@ -166,6 +158,59 @@ WriteLong(FILE *f, uint32_t x)
     }
 }
 
+//
+// slide the live cells down to the bottom of memory, so that the
+// image doesn't have to include the holes the gc left behind
+// must be called just after a gc, so that all dead cells are free
+//
+static int newidx[NUMCELLS];
+
+static Cell *
+forward(Cell *c)
+{
+    return c ? &mem[newidx[c - &mem[0]]] : NULL;
+}
+
+void
+CompactCells(void)
+{
+    int i, n;
+    Cell *c;
+
+    n = 0;
+    for (i = 0; i < NUMCELLS; i++) {
+        if (gettype(&mem[i]) != CT_FREE) {
+            newidx[i] = n++;
+        }
+    }
+    for (i = 0; i < NUMCELLS; i++) {
+        c = &mem[i];
+        switch (gettype(c)) {
+        case CT_A_PAIR:
+        case CT_S2_PAIR:
+        case CT_C2_PAIR:
+        case CT_NUM_PAIR:
+            setleft(c, forward(getleft(c)));
+            setright(c, forward(getright(c)));
+            break;
+        case CT_FUNC:
+            setarg(c, forward(getarg(c)));
+            break;
+        case CT_FREE:
+            continue;
+        default:
+            break;
+        }
+        if (newidx[i] != i) {
+            mem[newidx[i]] = *c;
+        }
+    }
+    for (i = n; i < NUMCELLS; i++) {
+        settype(&mem[i], CT_FREE);
+    }
+    g_root = forward(g_root);
+}
+
 static uint32_t propcell[NUMCELLS];
 
 void
@@ -200,7 +245,7 @@ extern bool gl_optimize;
 const char *gl_name = "compile";
 
 static void Usage() {
-    fprintf(stderr, "Usage: %s [-v][-O] file.lazy\n", gl_name);
+    fprintf(stderr, "Usage: %s [-v][-O][-p patterns] file.lazy\n", gl_name);
     exit(1);
 }
 
@@ -229,7 +274,15 @@ int main(int argc, char **argv)
     gl_name = argv[0];
     argv++; --argc;
     while (argv[0] && argv[0][0] == '-') {
-        parse_options(argv[0]+1);
+        if (argv[0][1] == 'p') {
+            // pattern file for the optimizer
+            if (!argv[1]) Usage();
+            load_patterns(argv[1]);
+            gl_optimize = true;
+            argv++; --argc;
+        } else {
+            parse_options(argv[0]+1);
+        }
         argv++; --argc;
     }
     if (argc != 1) {
@@ -241,10 +294,17 @@ int main(int argc, char **argv)
         perror(infile);
         return 1;
     }
-    g_root = parse_whole(f);
+    if (gl_optimize) {
+        g_root = parse_program(f);
+        g_root = prenorm(g_root, gl_verbose);
+        g_root = apply_input(g_root);
+    } else {
+        g_root = parse_whole(f);
+    }
     fclose(f);
 
     gc();
+    CompactCells();
     if (gl_verbose) {
         PrintTree(g_root);
     }
@@ -0,0 +1,206 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// value deduplication in the gc
+//
+// Reduction keeps making new copies of the same values: the numbers
+// apply_NumPair and Inc count with, the characters of the input, and
+// partial applications and conses built out of them. With -D the gc
+// looks up each value it is about to mark in a table of the values it
+// has marked already, and if an equal one is there, points at that
+// instead, so that the copy can be freed.
+//
+// A value is a number, a function cell whose argument (if it has
+// one) is a value, or a cons of two values, nested at most
+// DEDUP_DEPTH deep. Reduction never overwrites any of those (a packed
+// string only turns itself into an equal cons), so sharing one
+// changes nothing but the space it takes. Like a shortcut selector
+// thunk, the copy itself is still marked this time, in case something
+// on the C stack points at it.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lazy.h"
+
+// how deep a value we will look into
+#define DEDUP_DEPTH 4
+
+bool gl_dedup;
+unsigned long gl_deduped;
+
+// open addressing, at most half full; cleared by each gc
+static Cell **table;
+static size_t tablesize, numentries;
+
+static size_t
+hash(CellType t, uintptr_t a, uintptr_t b)
+{
+    uintptr_t h = t;
+
+    h = h * 0x9e3779b97f4a7c15ULL + a;
+    h = h * 0x9e3779b97f4a7c15ULL + b;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static bool
+same(Cell *c, CellType t, uintptr_t a, uintptr_t b)
+{
+    if (gettype(c) != t) return false;
+    switch (t) {
+    case CT_NUM:
+        return getnum(c) == (int)a;
+    case CT_FUNC:
+        return (uintptr_t)getfunc(c) == a && (uintptr_t)getarg(c) == b;
+    default:
+        return (uintptr_t)getleft(c) == a && (uintptr_t)getright(c) == b;
+    }
+}
+
+static void
+grow(void)
+{
+    Cell **old = table;
+    size_t oldsize = tablesize;
+    size_t i, j;
+    Cell *c;
+
+    tablesize = tablesize ? 2*tablesize : 4096;
+    table = calloc(tablesize, sizeof(Cell *));
+    if (!table) fatal("out of memory");
+    for (i = 0; i < oldsize; i++) {
+        c = old[i];
+        if (!c) continue;
+        switch (gettype(c)) {
+        case CT_NUM:
+            j = hash(CT_NUM, getnum(c), 0);
+            break;
+        case CT_FUNC:
+            j = hash(CT_FUNC, (uintptr_t)getfunc(c), (uintptr_t)getarg(c));
+            break;
+        default:
+            j = hash(gettype(c), (uintptr_t)getleft(c), (uintptr_t)getright(c));
+            break;
+        }
+        for (j &= tablesize-1; table[j]; j = (j+1) & (tablesize-1))
+            ;
+        table[j] = c;
+    }
+    free(old);
+}
+
+//
+// the value in the table equal to c, which is entered if there
+// isn't one yet; key is what it holds (its number, function and
+// argument, or left and right). If c is NULL there is nothing to
+// enter, and we return NULL when there's no match.
+//
+static Cell *
+lookup(Cell *c, CellType t, uintptr_t a, uintptr_t b)
+{
+    size_t i;
+
+    if (2*(numentries+1) > tablesize) {
+        grow();
+    }
+    for (i = hash(t, a, b) & (tablesize-1); table[i]; i = (i+1) & (tablesize-1)) {
+        if (same(table[i], t, a, b)) {
+            return table[i];
+        }
+    }
+    if (c) {
+        table[i] = c;
+        numentries++;
+    }
+    return c;
+}
+
+//
+// the canonical copy of c, or NULL if it isn't a value. We don't
+// change c itself: a copy among its children has to stay where it is
+// until the gc marks it (the caller may have it on the C stack), and
+// the gc points c at the canonical ones when it gets to them. Until
+// then c can only be matched, not entered.
+//
+static Cell *
+canonical(Cell *c, int depth)
+{
+    Cell *l, *r;
+
+    if (!c || c < frozen_end || depth == 0) return NULL;
+    switch (gettype(c)) {
+    case CT_NUM:
+        return lookup(c, CT_NUM, getnum(c), 0);
+    case CT_FUNC:
+        r = getarg(c);
+        if (r) {
+            r = canonical(r, depth-1);
+            if (!r) return NULL;
+        }
+        return lookup(r == getarg(c) ? c : NULL,
+                      CT_FUNC, (uintptr_t)getfunc(c), (uintptr_t)r);
+    case CT_C2_PAIR:
+        l = canonical(getleft(c), depth-1);
+        if (!l) return NULL;
+        r = canonical(getright(c), depth-1);
+        if (!r) return NULL;
+        return lookup(l == getleft(c) && r == getright(c) ? c : NULL,
+                      CT_C2_PAIR, (uintptr_t)l, (uintptr_t)r);
+    default:
+        return NULL;
+    }
+}
+
+//
+// called at the start of each gc
+//
+void
+dedup_begin(void)
+{
+    if (numentries > 0) {
+        memset(table, 0, tablesize * sizeof(Cell *));
+        numentries = 0;
+    }
+}
+
+//
+// what the gc should point at instead of c; the canonical copy is
+// shared from now on
+//
+Cell *
+dedup(Cell *c)
+{
+    Cell *to = canonical(c, DEDUP_DEPTH);
+
+    if (!to || to == c) return c;
+    setshared(to);
+    gl_deduped++;
+    return to;
+}
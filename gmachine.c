@@ -0,0 +1,497 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// G-machine style engine (lazy -G)
+//
+// Before the program runs, every closed subterm that is a
+// supercombinator (see supercomb.h) is compiled to a short piece of
+// bytecode that builds its body, and the subterm's cell is turned in
+// place into a function cell that runs that code once it has all its
+// arguments. The instructions are those of the G-machine's graph
+// building code:
+//
+//   G_ARG n     push argument n
+//   G_CONST n   push the supercombinator's constant n
+//   G_TEMP n    push the application built by the nth G_MKAP
+//   G_MKAP      pop a function and its argument, push an application
+//   G_UPDATE    pop a function and its argument, and overwrite the
+//               redex with the application
+//   G_RETURN    the body is just the cell on top of the stack
+//
+// Unwinding the spine and everything else stays with partial_eval;
+// a reduction that would have taken several S and K steps is simply
+// done in one go.
+//
+// A supercombinator of arity n still takes its arguments one at a
+// time: GM_k holds k of them, in a chain of C2 cells whose innermost
+// left cell is a number saying which supercombinator it is, or if it
+// has constants, a C2 of that number and a list of them. The
+// constants are the parts of the graph the body uses and the
+// applications of them that don't mention an argument, which are
+// built once; held like this rather than as gc roots, they go when
+// the program is done with the supercombinator, as the subterm it
+// replaced would have. An argument the body doesn't use isn't kept
+// in the chain either, since the S and K steps would have dropped it.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lazy.h"
+#include "supercomb.h"
+
+enum { G_ARG, G_CONST, G_TEMP, G_MKAP, G_UPDATE, G_RETURN };
+
+#define G_OP(op, n) ((op) | ((n) << 3))
+
+// the body, or each application in it, has at most two constant parts
+#define GM_MAX_CONSTS (2 * SC_MAX_SIZE + 1)
+
+typedef struct gcode {
+    int arity;
+    int ntemps;
+    int nconsts;
+    int start;      // index of the first instruction in gm_code
+    unsigned used;  // the arguments the body mentions, as a bit mask
+} GCode;
+
+static GCode *gm_scs;
+static int gm_numscs, gm_maxscs;
+
+static int *gm_code;
+static int gm_codelen, gm_maxcode;
+
+// while compiling, the constants of each supercombinator and then the
+// cell that will say which it is; these are gc roots until we are done
+static Cell **gm_consts;
+static int gm_numconsts, gm_maxconsts;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+#define GROW(arr, num, max) \
+    if ((num) >= (max)) { \
+        (max) = (max) ? 2*(max) : 256; \
+        (arr) = xrealloc((arr), (max) * sizeof((arr)[0])); \
+    }
+
+static void
+emit(int op)
+{
+    GROW(gm_code, gm_codelen, gm_maxcode);
+    gm_code[gm_codelen++] = op;
+}
+
+//
+// run supercombinator "which" on arguments a[] and the list of
+// constants k; r is the redex
+//
+static Cell *
+gm_run(Cell *r, int which, Cell **a, Cell *k)
+{
+    GCode *G = &gm_scs[which];
+    Cell *temps[SC_MAX_SIZE];
+    Cell *consts[GM_MAX_CONSTS];
+    Cell *stack[SC_MAX_SIZE + 2];
+    Cell **sp = stack;
+    Cell *fun, *arg;
+    int *pc = &gm_code[G->start];
+    int nt = 0;
+    int op, i;
+
+    // the body is built from new cells and cells we already hold,
+    // so getting all of them first means a gc can't happen halfway
+    if (G->ntemps) {
+        alloc_cells(temps, G->ntemps);
+    }
+    if (G->nconsts) {
+        for (i = 0; i < G->nconsts - 1; i++) {
+            consts[i] = getleft(k);
+            k = getright(k);
+        }
+        consts[i] = k;
+    }
+    for(;;) {
+        op = *pc++;
+        switch (op & 7) {
+        case G_ARG:
+            *sp++ = a[op >> 3];
+            break;
+        case G_CONST:
+            *sp++ = consts[op >> 3];
+            break;
+        case G_TEMP:
+            *sp++ = temps[op >> 3];
+            break;
+        case G_MKAP:
+            arg = *--sp;
+            fun = *--sp;
+            mkapply(temps[nt], fun, arg);
+            *sp++ = temps[nt++];
+            break;
+        case G_UPDATE:
+            arg = *--sp;
+            fun = *--sp;
+            mkapply(r, fun, arg);
+            return r;
+        case G_RETURN:
+        default:
+            return *--sp;
+        }
+    }
+}
+
+//
+// apply GM_k to x; self's arg holds k arguments
+//
+static Cell *
+gm_apply(Cell *r, Cell *self, Cell *x, int k, CellFunc *next)
+{
+    Cell *a[SC_MAX_ARITY];
+    Cell *p = getarg(self);
+    Cell *consts = NULL;
+    Cell *c;
+    int i;
+
+    a[k] = x;
+    for (i = k-1; i >= 0; --i) {
+        a[i] = getright(p);
+        p = getleft(p);
+    }
+    if (gettype(p) != CT_NUM) {
+        consts = getright(p);
+        p = getleft(p);
+    }
+    i = getnum(p);
+    if (k+1 == gm_scs[i].arity) {
+        return gm_run(r, i, a, consts);
+    }
+    c = alloc_cell();
+    // (the gc may have changed self while we allocated); an argument
+    // the body doesn't use isn't kept, as the graph wouldn't keep it
+    mkc2(c, getarg(self), (gm_scs[i].used & (1U << k)) ? x : getarg(self));
+    mkfunc(r, next, c);
+    return r;
+}
+
+static CellFunc *gm_funcs[SC_MAX_ARITY];
+
+#define GM_FUNC(k) \
+    static Cell * \
+    GM_##k(Cell *r, Cell *self, Cell *x) \
+    { \
+        return gm_apply(r, self, x, k, gm_funcs[(k)+1 < SC_MAX_ARITY ? (k)+1 : 0]); \
+    }
+
+GM_FUNC(0)
+GM_FUNC(1)
+GM_FUNC(2)
+GM_FUNC(3)
+GM_FUNC(4)
+GM_FUNC(5)
+GM_FUNC(6)
+GM_FUNC(7)
+
+static CellFunc *gm_funcs[SC_MAX_ARITY] = {
+    GM_0, GM_1, GM_2, GM_3, GM_4, GM_5, GM_6, GM_7,
+};
+
+//
+// compilation
+//
+
+// the supercombinators we've found, and the cells they replace
+static Supercomb **found;
+static int numfound, maxfound;
+
+static bool *seen;
+
+static int
+index_of(Cell *c)
+{
+    return c - &mem[0];
+}
+
+static int
+add_const(Cell *c)
+{
+    if (gm_numconsts >= gm_maxconsts) {
+        fatal("gmachine: too many constants");
+    }
+    gm_consts[gm_numconsts] = c;
+    return gm_numconsts++;
+}
+
+static void find_scs(Cell *c);
+
+// the variables t mentions, as a bit mask
+static unsigned
+var_mask(STerm *t)
+{
+    if (t->kind == ST_VAR) return 1U << t->var;
+    if (t->kind != ST_APP || !t->hasvar) return 0;
+    return var_mask(t->fun) | var_mask(t->arg);
+}
+
+static void
+check_lazy(STerm *t, void *arg)
+{
+    Supercomb *S = arg;
+
+    if (!(var_mask(t) & (1U << (S->arity - 1)))) S->size = -1;
+}
+
+//
+// in the graph, (T x) is evaluated once however many times it is
+// then applied, and so is anything in it that only depends on x;
+// code that builds the whole body once all the arguments are there
+// would do that work again on every call. So we only take bodies
+// in which every application needs the last argument.
+//
+static bool
+fully_lazy(Supercomb *S)
+{
+    sc_walk_body(S->body, check_lazy, S);
+    return S->size >= 0;
+}
+
+static void
+find_in_const(STerm *t, void *arg)
+{
+    if (t->kind == ST_CELL) find_scs(t->cell);
+}
+
+//
+// find the supercombinators reachable from c; we don't look inside
+// one, except at the parts of the graph its body still uses
+//
+static void
+find_scs(Cell *c)
+{
+    Supercomb S;
+
+    if (!c || seen[index_of(c)]) return;
+    seen[index_of(c)] = true;
+    switch (gettype(c)) {
+    case CT_A_PAIR:
+        if (sc_extract(c, &S) && fully_lazy(&S)) {
+            GROW(found, numfound, maxfound);
+            found[numfound] = xrealloc(NULL, sizeof(S));
+            *found[numfound++] = S;
+            sc_walk_consts(S.body, find_in_const, NULL);
+            return;
+        }
+        /* fall through */
+    case CT_S2_PAIR:
+    case CT_C2_PAIR:
+    case CT_NUM_PAIR:
+        find_scs(getleft(c));
+        find_scs(getright(c));
+        break;
+    case CT_FUNC:
+        find_scs(getarg(c));
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+count_const(STerm *t, void *arg)
+{
+    (*(int *)arg)++;
+}
+
+// the cells of the graph that the code uses are constants
+static void
+keep_cell(STerm *t, void *arg)
+{
+    if (t->kind == ST_CELL) t->id = add_const(t->cell);
+}
+
+// constant applications are built once, and given a constant too
+static void
+build_const(STerm *t, void *arg)
+{
+    Cell *c;
+
+    if (t->kind == ST_APP) {
+        c = alloc_cell();
+        mkapply(c, gm_consts[t->fun->id], gm_consts[t->arg->id]);
+        t->id = add_const(c);
+    }
+}
+
+static int numtemps;
+
+// the constants the body uses directly, which the supercombinator
+// holds in its list
+static int sc_consts[GM_MAX_CONSTS];
+static int sc_numconsts;
+
+static int
+local_const(int id)
+{
+    int i;
+
+    for (i = 0; i < sc_numconsts; i++) {
+        if (sc_consts[i] == id) return i;
+    }
+    if (sc_numconsts >= GM_MAX_CONSTS) {
+        fatal("gmachine: too many constants");
+    }
+    sc_consts[sc_numconsts] = id;
+    return sc_numconsts++;
+}
+
+// an application that mentions a variable has id 1 + its temp
+// number once it has been built
+static void
+compile_term(STerm *t, bool top)
+{
+    if (t->kind == ST_VAR) {
+        emit(G_OP(G_ARG, t->var));
+    } else if (!t->hasvar) {
+        emit(G_OP(G_CONST, local_const(t->id)));
+    } else if (t->id) {
+        emit(G_OP(G_TEMP, t->id - 1));
+    } else {
+        compile_term(t->fun, false);
+        compile_term(t->arg, false);
+        if (top) {
+            emit(G_OP(G_UPDATE, 0));
+        } else {
+            emit(G_OP(G_MKAP, 0));
+            t->id = 1 + numtemps++;
+        }
+    }
+}
+
+static void
+compile_sc(Supercomb *S)
+{
+    GCode *G;
+
+    GROW(gm_scs, gm_numscs, gm_maxscs);
+    G = &gm_scs[gm_numscs++];
+    G->arity = S->arity;
+    G->start = gm_codelen;
+    numtemps = 0;
+    sc_numconsts = 0;
+    if (S->body->kind == ST_APP && S->body->hasvar) {
+        compile_term(S->body, true);
+    } else {
+        compile_term(S->body, false);
+        emit(G_OP(G_RETURN, 0));
+    }
+    G->ntemps = numtemps;
+    G->used = var_mask(S->body);
+    G->nconsts = sc_numconsts;
+}
+
+//
+// compile the program rooted at prog; returns the number of
+// supercombinators found
+//
+int
+gm_compile(Cell *prog)
+{
+    int i, j, n;
+    Cell *c, *cells[2];
+    Cell **heads;
+
+    seen = calloc(NUMCELLS, sizeof(bool));
+    if (!seen) fatal("out of memory");
+    find_scs(prog);
+    free(seen);
+    if (numfound == 0) return 0;
+
+    // while we allocate, the cells we are going to change, the parts
+    // of the graph the code uses, the constant applications and the
+    // cells that will say which supercombinator is which are all
+    // held as roots
+    n = 2 * numfound;
+    for (i = 0; i < numfound; i++) {
+        sc_walk_consts(found[i]->body, count_const, &n);
+    }
+    gm_maxconsts = n;
+    gm_consts = xrealloc(NULL, n * sizeof(Cell *));
+    memset(gm_consts, 0, n * sizeof(Cell *));
+    add_roots(gm_consts, n);
+    heads = gm_consts + n - numfound;
+
+    // nothing is allocated until every cell we need is held
+    for (i = 0; i < numfound; i++) {
+        add_const(found[i]->cell);
+        sc_walk_consts(found[i]->body, keep_cell, NULL);
+    }
+    for (i = 0; i < numfound; i++) {
+        sc_walk_consts(found[i]->body, build_const, NULL);
+        compile_sc(found[i]);
+
+        // the list of the constants it uses is built from the end,
+        // with the part built so far in heads[i]
+        if (sc_numconsts > 0) {
+            heads[i] = gm_consts[sc_consts[sc_numconsts - 1]];
+            for (j = sc_numconsts - 2; j >= 0; j--) {
+                c = alloc_cell();
+                mkc2(c, gm_consts[sc_consts[j]], heads[i]);
+                setshared(c);
+                heads[i] = c;
+            }
+        }
+        alloc_cells(cells, sc_numconsts > 0 ? 2 : 1);
+        mknum(cells[0], i);
+        setshared(cells[0]);
+        if (sc_numconsts > 0) {
+            mkc2(cells[1], cells[0], heads[i]);
+            setshared(cells[1]);
+            heads[i] = cells[1];
+        } else {
+            heads[i] = cells[0];
+        }
+    }
+    for (i = 0; i < numfound; i++) {
+        mkfunc(found[i]->cell, GM_0, heads[i]);
+    }
+    // the compiled code keeps using the constants, so they mustn't
+    // be changed in place
+    for (i = 0; i < gm_numconsts; i++) {
+        setshared(gm_consts[i]);
+    }
+    // from here on each supercombinator holds its own constants, so
+    // they go once the program is done with it
+    memset(gm_consts, 0, n * sizeof(Cell *));
+    return numfound;
+}
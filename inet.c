@@ -0,0 +1,898 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// interaction net engine (lazy -I)
+//
+// The graph reducer shares a value once it has been evaluated, but a
+// function that is copied before it is applied (S handing its third
+// argument to both halves, say) has its body reduced once for each
+// copy. This engine reduces in Lamping's optimal style instead, where
+// no redex is ever copied: the program is translated to a sharing
+// graph of lambdas, applications and fans (duplicators), with muxes
+// giving every node a level so that each fan knows which other fan
+// it pairs up with. The graph is rewritten by local interactions
+// between two nodes joined at their principal ports (an active pair);
+// the rules are those of Asperti and Guerrini's book, where a control
+// node meeting a node at a higher level passes through it, copying it
+// (a fan) or moving it up or down (a mux), and two control nodes of
+// the same level that meet cancel out. A mux does the work of a run
+// of croissants and brackets, as in BOHM: one that moves everything
+// above level i by k, so that a chain of them is one node and one
+// interaction rather than one for each, and a fan with one of its
+// copies erased is taken out rather than left to copy for nothing.
+//
+// S, K, C, + and numbers are closed constants, which only expand into
+// their lambda terms when they are applied, and the input from its
+// kth character on is another; so nothing is built until it is
+// needed. Output works as in eval_loop: an observer takes the list to
+// (out (list K) (list (K I))), and then the head is applied to + and 0,
+// each reduced to weak head normal form by walking down from the root
+// along principal ports until two of them face each other.
+//
+// Every node has just one principal port, so active pairs never
+// overlap and could all be reduced at once: inet_active_pairs lists
+// them, for a parallel engine to share out. This one only reduces the
+// pairs that the output depends on, except that erasers always run
+// straight away, so that garbage is freed as soon as it is cut off.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lazy.h"
+
+//
+// a port is a node number and which of its ports (0 is the principal
+// one); node 0 is never used, so port 0 is "nothing"
+//
+typedef uint32_t Port;
+#define PORT(n, s) (((n) << 2) | (s))
+#define NODE(p) ((p) >> 2)
+#define SLOT(p) ((p) & 3)
+
+enum {
+    // with two auxiliary ports
+    N_LAM,          // 1 body, 2 variable
+    N_APP,          // 0 function, 1 argument, 2 result
+    N_OUT,          // an observed cons: 1 head, 2 tail (a level up)
+    // one
+    N_INC,          // + waiting for its argument: 0 argument, 1 result
+    // control nodes
+    N_FAN,          // 0 the shared side, 1 and 2 the two sharers
+    N_MUX,          // moves what comes through it by value levels, if
+                    // it is above this one's
+    N_ROOT,         // whatever we're evaluating hangs off port 1
+    // none
+    N_ERA,
+    // closed constants: S, K, C, +, a number, the input from character
+    // value on, and the observer that catches a cons
+    N_S, N_K, N_C, N_PLUS, N_NUM, N_READ, N_OBS,
+    N_FREE
+};
+
+static const char arity[] = { 2, 2, 2, 1, 2, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+static const char *const kind_name[] = {
+    "lambda", "apply", "out", "inc", "fan", "mux", "root",
+    "eraser", "S", "K", "C", "+", "number", "read", "observer", "free"
+};
+
+#define is_control(k) ((k) == N_FAN || (k) == N_MUX)
+#define is_constant(k) ((k) >= N_S && (k) < N_FREE)
+
+typedef struct inet_node {
+    uint8_t kind;
+    unsigned level;
+    unsigned value;         // of a number or read
+    Port port[3];
+} Node;
+
+// Nothing that the output so far has shared is ever released: the
+// fans and muxes for every character stay in the net, so a long run
+// needs a lot of nodes (about half a million for each character rot13
+// writes). Past this many, 24 bytes each, it stops with an error
+// rather than take all the memory.
+#define MAX_NODES (1U << 26)
+
+static Node *net;
+static uint32_t net_size, net_top, free_nodes;
+
+// the level the output is being observed at; each character's tail is
+// a level deeper, as if the loop were a term with the rest inside it
+static unsigned frame;
+
+// active pairs, in the order they were made; some may have been
+// reduced since
+static uint32_t (*pairs)[2];
+static size_t num_pairs, max_pairs;
+// pairs with an eraser, to be reduced straight away
+static uint32_t (*erasing)[2];
+static size_t num_erasing, max_erasing;
+
+// statistics
+static unsigned long interactions, betas, expansions, fan_ops, level_ops, erasures;
+static unsigned long live_nodes, peak_nodes, live_pairs, peak_pairs;
+
+static void *
+grow(void *p, size_t *max, size_t size)
+{
+    *max = *max ? 2 * *max : 4096;
+    p = realloc(p, *max * size);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+static uint32_t
+new_node(int kind, unsigned level)
+{
+    uint32_t n;
+    Node *N;
+
+    if (free_nodes) {
+        n = free_nodes;
+        free_nodes = net[n].port[0];
+    } else {
+        if (net_top == net_size) {
+            size_t size = net_size;
+            if (size >= MAX_NODES) {
+                // keep the output so far; fatal would lose it
+                io_flush(gl_io);
+                fprintf(stderr, "inet: too many nodes after %u characters of output "
+                        "(-I keeps the sharing for all of them)\n", frame);
+                exit(1);
+            }
+            net = grow(net, &size, sizeof(Node));
+            net_size = size;
+            if (net_top == 0) net_top = 1;
+        }
+        n = net_top++;
+    }
+    N = &net[n];
+    N->kind = kind;
+    N->level = level;
+    N->value = 0;
+    N->port[0] = N->port[1] = N->port[2] = 0;
+    if (++live_nodes > peak_nodes) peak_nodes = live_nodes;
+    return n;
+}
+
+static void
+free_node(uint32_t n)
+{
+    net[n].kind = N_FREE;
+    net[n].port[0] = free_nodes;
+    free_nodes = n;
+    --live_nodes;
+}
+
+static void
+push_pair(uint32_t (**stack)[2], size_t *num, size_t *max, uint32_t a, uint32_t b)
+{
+    if (*num == *max) {
+        *stack = grow(*stack, max, sizeof(**stack));
+    }
+    (*stack)[*num][0] = a;
+    (*stack)[*num][1] = b;
+    ++*num;
+}
+
+static bool
+is_active(uint32_t a, uint32_t b)
+{
+    return net[a].kind != N_FREE && net[a].port[0] == PORT(b, 0);
+}
+
+//
+// drop the pairs that have been reduced, so that there is room for
+// more (or make more room, if they are all still there)
+//
+static void
+compact_pairs(void)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < num_pairs; i++) {
+        if (is_active(pairs[i][0], pairs[i][1])) {
+            pairs[n][0] = pairs[i][0];
+            pairs[n][1] = pairs[i][1];
+            n++;
+        }
+    }
+    num_pairs = n;
+    if (num_pairs >= max_pairs / 2) {
+        pairs = grow(pairs, &max_pairs, sizeof(*pairs));
+    }
+}
+
+//
+// join two ports with a wire
+//
+static void
+link(Port p, Port q)
+{
+    uint32_t a = NODE(p), b = NODE(q);
+
+    net[a].port[SLOT(p)] = q;
+    net[b].port[SLOT(q)] = p;
+    if (SLOT(p) == 0 && net[a].kind == N_ERA && SLOT(q) != 0 && net[b].kind == N_FAN) {
+        // a copy nothing wants; see run_erasers
+        push_pair(&erasing, &num_erasing, &max_erasing, a, b);
+        return;
+    }
+    if (SLOT(q) == 0 && net[b].kind == N_ERA && SLOT(p) != 0 && net[a].kind == N_FAN) {
+        push_pair(&erasing, &num_erasing, &max_erasing, b, a);
+        return;
+    }
+    if (SLOT(p) == 0 && SLOT(q) == 0) {
+        if (net[a].kind == N_ERA || net[b].kind == N_ERA) {
+            push_pair(&erasing, &num_erasing, &max_erasing, a, b);
+            return;
+        }
+        if (num_pairs == max_pairs) {
+            compact_pairs();
+        }
+        pairs[num_pairs][0] = a;
+        pairs[num_pairs][1] = b;
+        num_pairs++;
+        if (++live_pairs > peak_pairs) peak_pairs = live_pairs;
+    }
+}
+
+static Port
+constant(int kind, unsigned value)
+{
+    uint32_t n = new_node(kind, 0);
+    net[n].value = value;
+    return PORT(n, 0);
+}
+
+static Port
+apply(unsigned level, Port fn, Port arg)
+{
+    uint32_t a = new_node(N_APP, level);
+    link(PORT(a, 0), fn);
+    link(PORT(a, 1), arg);
+    return PORT(a, 2);
+}
+
+static Port
+eraser(void)
+{
+    return PORT(new_node(N_ERA, 0), 0);
+}
+
+//
+// the lambda terms that constants expand to, applied to an argument
+// x; variables are numbered, x being 0
+//
+enum { T_VAR, T_LAM, T_APP, T_OUT, T_INC, T_CONST };
+// how a constant in a term gets its value from the one being expanded
+enum { V_SAME, V_PRED, V_NEXT, V_BYTE };
+#define MAXVARS 3
+
+typedef struct term {
+    uint8_t op;
+    uint8_t var;            // T_VAR, T_LAM
+    uint8_t kind, how;      // T_CONST
+    const struct term *a, *b;
+} Term;
+
+static Term terms[48];
+static int num_terms;
+static const Term *t_S, *t_K, *t_C, *t_plus, *t_num0, *t_num1, *t_num, *t_read, *t_obs;
+
+static const Term *
+mkterm(int op, int var, const Term *a, const Term *b)
+{
+    Term *t = &terms[num_terms++];
+    t->op = op;
+    t->var = var;
+    t->a = a;
+    t->b = b;
+    return t;
+}
+
+#define var(v) mkterm(T_VAR, v, NULL, NULL)
+#define lam(v, body) mkterm(T_LAM, v, body, NULL)
+#define app(f, x) mkterm(T_APP, 0, f, x)
+
+static const Term *
+con(int kind, int how)
+{
+    Term *t = (Term *)mkterm(T_CONST, 0, NULL, NULL);
+    t->kind = kind;
+    t->how = how;
+    return t;
+}
+
+static void
+init_terms(void)
+{
+    enum { x, y, z };
+
+    // S x = \y.\z. x z (y z)
+    t_S = lam(y, lam(z, app(app(var(x), var(z)), app(var(y), var(z)))));
+    // K x = \y. x
+    t_K = lam(y, var(x));
+    // C x = \y.\z. z x y
+    t_C = lam(y, lam(z, app(app(var(z), var(x)), var(y))));
+    // + x waits for x to be a number
+    t_plus = mkterm(T_INC, 0, var(x), NULL);
+    // 0 x = \y. y, 1 x = x, and n x = \y. x ((n-1) x y)
+    t_num0 = lam(y, var(y));
+    t_num1 = var(x);
+    t_num = lam(y, app(var(x), app(app(con(N_NUM, V_PRED), var(x)), var(y))));
+    // the input from k on, applied to x, is x (byte k) (the input from k+1 on)
+    t_read = app(app(var(x), con(N_NUM, V_BYTE)), con(N_READ, V_NEXT));
+    // the observer of list x is (out (x K) (x (K I))), as car and cdr
+    t_obs = mkterm(T_OUT, 0, app(var(x), con(N_K, V_SAME)),
+                   app(var(x), app(con(N_K, V_SAME), lam(y, var(y)))));
+}
+
+//
+// the input, as far as it has been read
+//
+static unsigned char *input;
+static size_t input_len, input_max;
+static bool input_done;
+
+static unsigned
+input_byte(unsigned k)
+{
+    while (k >= input_len && !input_done) {
+        int c = getch();
+        if (c < 0) {
+            input_done = true;
+            break;
+        }
+        if (input_len == input_max) {
+            input = grow(input, &input_max, 1);
+        }
+        input[input_len++] = c;
+    }
+    return k < input_len ? input[k] : 256;
+}
+
+//
+// put a mux moving things above level by offset on the way into p,
+// which is where a variable is used; if there is one there already
+// the two make one, or nothing at all if they cancel out
+//
+static Port
+add_mux(Port p, unsigned level, int offset)
+{
+    uint32_t n = NODE(p);
+    unsigned below = net[n].level;
+
+    if (SLOT(p) == 0 && net[n].kind == N_MUX && level <= below && below <= level + offset) {
+        net[n].level = level;
+        net[n].value += offset;
+        if (net[n].value == 0) {
+            p = net[n].port[1];
+            free_node(n);
+        }
+        return p;
+    }
+    n = new_node(N_MUX, level);
+    net[n].value = offset;
+    link(PORT(n, 1), p);
+    return PORT(n, 0);
+}
+
+//
+// join the occurrences in sub of variables to those in occ, sharing
+// any that are in both with a fan; sub is a level deeper if door is
+// set, and its variables are moved back up a level on the way out
+//
+static void
+merge(Port *occ, Port *sub, unsigned level, bool door)
+{
+    int v;
+    uint32_t n;
+    Port p;
+
+    for (v = 0; v < MAXVARS; v++) {
+        if (!sub[v]) continue;
+        p = sub[v];
+        if (door) {
+            p = add_mux(p, level, 1);
+        }
+        if (occ[v]) {
+            n = new_node(N_FAN, level);
+            link(PORT(n, 1), occ[v]);
+            link(PORT(n, 2), p);
+            p = PORT(n, 0);
+        }
+        occ[v] = p;
+    }
+}
+
+//
+// build term t at level, with the constants taking their values from
+// param; returns its root, and fills in occ (which starts out empty)
+// with where each of its free variables is used
+//
+static Port
+build(const Term *t, unsigned level, Port *occ, unsigned param)
+{
+    Port sub[MAXVARS] = { 0 };
+    Port r;
+    uint32_t n;
+    int v;
+
+    switch (t->op) {
+    case T_VAR:
+        // moving the argument it stands for down to this level
+        n = new_node(N_MUX, level);
+        net[n].value = -1;
+        occ[t->var] = PORT(n, 0);
+        return PORT(n, 1);
+    case T_LAM:
+        n = new_node(N_LAM, level);
+        link(PORT(n, 1), build(t->a, level, occ, param));
+        link(PORT(n, 2), occ[t->var] ? occ[t->var] : eraser());
+        occ[t->var] = 0;
+        return PORT(n, 0);
+    case T_APP:
+        r = build(t->a, level, occ, param);
+        r = apply(level, r, build(t->b, level+1, sub, param));
+        merge(occ, sub, level, true);
+        return r;
+    case T_OUT:
+        n = new_node(N_OUT, level);
+        link(PORT(n, 1), build(t->a, level, occ, param));
+        // the tail is the argument of the next observer, which is in
+        // turn an argument of this one, so it is two levels up
+        link(PORT(n, 2), build(t->b, level+2, sub, param));
+        for (v = 0; v < MAXVARS; v++) {
+            if (sub[v]) sub[v] = add_mux(sub[v], level+1, 1);
+        }
+        merge(occ, sub, level, true);
+        return PORT(n, 0);
+    case T_INC:
+        n = new_node(N_INC, level);
+        link(PORT(n, 0), build(t->a, level, occ, param));
+        return PORT(n, 1);
+    case T_CONST:
+        switch (t->how) {
+        case V_PRED: param--; break;
+        case V_NEXT: param++; break;
+        case V_BYTE: param = input_byte(param); break;
+        }
+        return constant(t->kind, param);
+    }
+    fatal("inet: bad term");
+    return 0;
+}
+
+//
+// the interactions
+//
+
+static void
+no_rule(uint32_t a, uint32_t b)
+{
+    fprintf(stderr, "inet: no rule for %s at level %u and %s at level %u\n",
+            kind_name[net[a].kind], net[a].level,
+            kind_name[net[b].kind], net[b].level);
+    fatal("inet: stuck");
+}
+
+// an application meets a lambda
+static void
+beta(uint32_t app, uint32_t lam)
+{
+    Port body = net[lam].port[1], var = net[lam].port[2];
+    Port arg = net[app].port[1], res = net[app].port[2];
+
+    if (net[app].level != net[lam].level) no_rule(app, lam);
+    betas++;
+    free_node(app);
+    free_node(lam);
+    // \x.x, when the levels in between have cancelled out
+    if (body == PORT(lam, 2)) {
+        link(res, arg);
+        return;
+    }
+    link(res, body);
+    link(arg, var);
+}
+
+// an application meets a constant, which expands into its term
+static void
+expand(uint32_t app, uint32_t c)
+{
+    unsigned level = net[app].level, value = net[c].value;
+    Port arg = net[app].port[1], res = net[app].port[2];
+    Port occ[MAXVARS] = { 0 };
+    const Term *t;
+
+    switch (net[c].kind) {
+    case N_S: t = t_S; break;
+    case N_K: t = t_K; break;
+    case N_C: t = t_C; break;
+    case N_PLUS: t = t_plus; break;
+    case N_NUM: t = value == 0 ? t_num0 : value == 1 ? t_num1 : t_num; break;
+    case N_READ: t = t_read; break;
+    case N_OBS: t = t_obs; break;
+    default: no_rule(app, c); return;
+    }
+    free_node(app);
+    free_node(c);
+    link(res, build(t, level, occ, value));
+    link(arg, occ[0] ? occ[0] : eraser());
+    expansions++;
+}
+
+//
+// x passes through y: each of x's auxiliary ports gets a copy of y,
+// moved shift levels, and each of y's a copy of x
+//
+static void
+commute(uint32_t x, uint32_t y, int shift)
+{
+    int ax = arity[net[x].kind], ay = arity[net[y].kind];
+    unsigned level = net[y].level + shift;
+    Port xn[2], yn[2];
+    uint32_t xs[2], ys[2];
+    int i, j;
+
+    for (i = 0; i < ax; i++) {
+        xn[i] = net[x].port[1+i];
+        if (NODE(xn[i]) == y) fatal("inet: a pair that loops back on itself");
+    }
+    for (j = 0; j < ay; j++) {
+        yn[j] = net[y].port[1+j];
+    }
+    for (i = 0; i < ax; i++) {
+        if (i == 0) {
+            ys[i] = y;
+        } else {
+            ys[i] = new_node(net[y].kind, level);
+            net[ys[i]].value = net[y].value;
+        }
+        net[ys[i]].level = level;
+    }
+    for (j = 0; j < ay; j++) {
+        if (j == 0) {
+            xs[j] = x;
+        } else {
+            xs[j] = new_node(net[x].kind, net[x].level);
+            net[xs[j]].value = net[x].value;
+        }
+    }
+    if (ax == 0) free_node(y);
+    if (ay == 0) free_node(x);
+    for (i = 0; i < ax; i++) {
+        link(PORT(ys[i], 0), xn[i]);
+    }
+    for (j = 0; j < ay; j++) {
+        link(PORT(xs[j], 0), yn[j]);
+    }
+    for (i = 0; i < ax; i++) {
+        for (j = 0; j < ay; j++) {
+            link(PORT(ys[i], 1+j), PORT(xs[j], 1+i));
+        }
+    }
+}
+
+// two of a kind at the same level cancel out
+static void
+annihilate(uint32_t x, uint32_t y)
+{
+    int i, n = arity[net[x].kind];
+    Port xn[2], yn[2];
+
+    for (i = 0; i < n; i++) {
+        xn[i] = net[x].port[1+i];
+        yn[i] = net[y].port[1+i];
+    }
+    free_node(x);
+    free_node(y);
+    for (i = 0; i < n; i++) {
+        // a wire from one of them straight to the other just goes
+        if (NODE(xn[i]) == y) continue;
+        link(xn[i], yn[i]);
+    }
+}
+
+static int
+shift_of(uint32_t x)
+{
+    return net[x].kind == N_MUX ? (int)net[x].value : 0;
+}
+
+// two control nodes meet
+static void
+control(uint32_t a, uint32_t b)
+{
+    int ka = net[a].kind, kb = net[b].kind;
+
+    if (net[a].level < net[b].level) {
+        commute(a, b, shift_of(a));
+    } else if (net[b].level < net[a].level) {
+        commute(b, a, shift_of(b));
+    } else if (ka == kb && net[a].value == net[b].value) {
+        // a node that has gone both ways round a loop meets itself
+        annihilate(a, b);
+    } else if (ka == N_FAN) {
+        // a fan copying an argument out through one of its doors
+        commute(a, b, 0);
+    } else {
+        no_rule(a, b);
+        return;
+    }
+    if (ka == N_FAN || kb == N_FAN) {
+        fan_ops++;
+    } else {
+        level_ops++;
+    }
+}
+
+static void
+interact(uint32_t a, uint32_t b)
+{
+    int ka, kb;
+
+    if (net[a].kind > net[b].kind) {
+        uint32_t t = a; a = b; b = t;
+    }
+    ka = net[a].kind;
+    kb = net[b].kind;
+    interactions++;
+    if (kb == N_ERA) {
+        commute(b, a, 0);
+        erasures++;
+    } else if (ka == N_ERA) {
+        commute(a, b, 0);
+        erasures++;
+    } else if (ka == N_LAM && kb == N_APP) {
+        beta(b, a);
+    } else if (ka == N_APP && is_constant(kb)) {
+        expand(a, b);
+    } else if (ka == N_INC && kb == N_NUM) {
+        Port res = net[a].port[1];
+        free_node(a);
+        net[b].value++;
+        link(res, PORT(b, 0));
+    } else if (ka <= N_INC && is_control(kb)) {
+        if (net[b].level >= net[a].level) no_rule(a, b);
+        commute(b, a, shift_of(b));
+        if (kb == N_FAN) fan_ops++; else level_ops++;
+    } else if (is_control(ka) && is_control(kb)) {
+        control(a, b);
+    } else if (is_control(ka) && is_constant(kb)) {
+        // constants are closed, so levels don't matter to them
+        commute(a, b, 0);
+        if (ka == N_FAN) fan_ops++; else level_ops++;
+    } else if (ka == N_INC) {
+        fatal("Inc called on non-number");
+    } else {
+        no_rule(a, b);
+    }
+}
+
+static void
+run_erasers(void)
+{
+    uint32_t a, b;
+
+    while (num_erasing > 0) {
+        --num_erasing;
+        a = erasing[num_erasing][0];
+        b = erasing[num_erasing][1];
+        if (is_active(a, b)) {
+            interact(a, b);
+        } else if (net[a].kind == N_ERA && net[b].kind == N_FAN
+                   && NODE(net[a].port[0]) == b) {
+            // a fan with one of its copies erased is just a wire
+            Port in = net[b].port[0];
+            Port out = net[b].port[3 - SLOT(net[a].port[0])];
+            free_node(a);
+            free_node(b);
+            link(in, out);
+            interactions++;
+            erasures++;
+        }
+    }
+}
+
+//
+// reduce the net hanging off root to weak head normal form, and
+// return the port it ends at. The path is the nodes we came into by
+// an auxiliary port and left by the principal one.
+//
+static uint32_t *path;
+static size_t path_max;
+
+static Port
+whnf(uint32_t root)
+{
+    size_t depth = 0;
+    Port p = net[root].port[1];
+    uint32_t n, m;
+
+    for (;;) {
+        n = NODE(p);
+        if (SLOT(p) != 0) {
+            if (depth == path_max) {
+                path = grow(path, &path_max, sizeof(*path));
+            }
+            if (depth > live_nodes) fatal("inet: a vicious circle");
+            path[depth++] = n;
+            p = net[n].port[0];
+            continue;
+        }
+        if (depth == 0) {
+            return p;
+        }
+        m = path[--depth];
+        --live_pairs;
+        interact(m, n);
+        run_erasers();
+        p = depth ? net[path[depth-1]].port[0] : net[root].port[1];
+    }
+}
+
+//
+// translate a parsed program; the graph has no variables, just
+// applications of constants
+//
+static Port
+build_cell(Cell *c, unsigned level)
+{
+    CellFunc *fn;
+    int k;
+
+    switch (gettype(c)) {
+    case CT_A_PAIR:
+    case CT_NUM_PAIR:
+        return apply(level, build_cell(getleft(c), level), build_cell(getright(c), level+1));
+    case CT_S2_PAIR:
+    case CT_C2_PAIR:
+        k = gettype(c) == CT_S2_PAIR ? N_S : N_C;
+        return apply(level, apply(level, constant(k, 0), build_cell(getleft(c), level+1)),
+                     build_cell(getright(c), level+1));
+    case CT_NUM:
+        return constant(N_NUM, getnum(c));
+    case CT_FUNC:
+        fn = getfunc(c);
+        if (fn == K_func) return constant(N_K, 0);
+        if (fn == S_func) return constant(N_S, 0);
+        if (fn == C_func) return constant(N_C, 0);
+        if (fn == Inc_func) return constant(N_PLUS, 0);
+        if (fn == KI_func) return constant(N_NUM, 0);
+        k = fn == K1_func ? N_K : fn == S1_func ? N_S : fn == C1_func ? N_C : -1;
+        if (k >= 0) {
+            return apply(level, constant(k, 0), build_cell(getarg(c), level+1));
+        }
+        break;
+    default:
+        break;
+    }
+    fatal("inet: can't translate the program");
+    return 0;
+}
+
+static uint32_t root, held;
+
+//
+// parse a program, and translate it applied to the input
+//
+void
+inet_load(const char *text, bool optimize)
+{
+    Cell *prog;
+
+    if (optimize) {
+        gl_optimize = true;
+    }
+    prog = parse_text(text);
+    if (optimize) {
+        prog = prenorm(prog, false);
+    }
+    init_terms();
+    root = new_node(N_ROOT, 0);
+    held = new_node(N_ROOT, 0);
+    link(PORT(held, 1), apply(1, build_cell(prog, 1), constant(N_READ, 0)));
+}
+
+//
+// the main loop, as eval_loop
+//
+int
+inet_eval(void)
+{
+    Port p;
+    uint32_t n;
+    unsigned outc;
+
+    for (;;) {
+        // the observer applied to the list gives (out head tail)
+        link(PORT(root, 1), apply(frame, constant(N_OBS, 0), net[held].port[1]));
+        p = whnf(root);
+        n = NODE(p);
+        if (net[n].kind != N_OUT || net[n].level != frame) {
+            fatal("inet: the output isn't a list");
+        }
+        link(PORT(held, 1), net[n].port[2]);
+        // ((head +) 0)
+        link(PORT(root, 1), apply(frame, apply(frame, net[n].port[1], constant(N_PLUS, 0)),
+                                  constant(N_NUM, 0)));
+        free_node(n);
+        p = whnf(root);
+        n = NODE(p);
+        if (net[n].kind != N_NUM) {
+            fatal("inet: an output character isn't a number");
+        }
+        outc = net[n].value;
+        free_node(n);
+        if (outc >= 256) {
+            io_flush(gl_io);
+            return outc - 256;
+        }
+        putch(outc);
+        frame++;
+    }
+}
+
+//
+// up to max of the active pairs, two node numbers for each; any of
+// them may be given to inet_reduce_pair, in any order
+//
+size_t
+inet_active_pairs(unsigned *out, size_t max)
+{
+    size_t i, n = 0;
+
+    compact_pairs();
+    for (i = 0; i < num_pairs && n < max; i++, n++) {
+        out[2*n] = pairs[i][0];
+        out[2*n+1] = pairs[i][1];
+    }
+    return n;
+}
+
+void
+inet_reduce_pair(unsigned a, unsigned b)
+{
+    if (!is_active(a, b)) return;
+    --live_pairs;
+    interact(a, b);
+    run_erasers();
+}
+
+void
+inet_report(void)
+{
+    fprintf(stderr, "inet: %lu interactions (%lu beta, %lu constants, %lu fan, "
+            "%lu level, %lu erasing), %lu nodes at most, %lu active pairs at most\n",
+            interactions, betas, expansions, fan_ops, level_ops, erasures,
+            peak_nodes, peak_pairs);
+}
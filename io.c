@@ -0,0 +1,294 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// I/O backends for the host builds
+//
+// getch and putch (lazy.h) only move bytes in and out of gl_io's
+// buffers; the backend's read and write callbacks are called to
+// refill or empty them a block at a time. Before blocking on a read
+// we empty the output buffer, since whoever is sending the input may
+// be waiting for it (the prompt of an interactive program, say).
+//
+// io_stdio goes through stdin and stdout, as the interpreter always
+// has; io_fd uses read and write with large buffers; io_memory
+// takes its input from a buffer and keeps the output in another, so
+// that nothing but the evaluator is being timed.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#include "lazy.h"
+
+#define FD_BUFSIZE 65536
+
+int
+io_fill(LazyIO *io)
+{
+    size_t n;
+
+    io_flush(io);
+    n = (*io->read)(io, io->inbuf, io->insize);
+    if (n == 0) {
+        return -1;
+    }
+    io->inpos = io->inbuf;
+    io->inend = io->inbuf + n;
+    return *io->inpos++;
+}
+
+int
+io_drain(LazyIO *io, int c)
+{
+    unsigned char b = c;
+
+    io_flush(io);
+    if (io->outpos == io->outend) {
+        // no output buffer at all
+        (*io->write)(io, &b, 1);
+    } else {
+        *io->outpos++ = b;
+    }
+    return c;
+}
+
+void
+io_flush(LazyIO *io)
+{
+    size_t n = io->outpos - io->outbuf;
+
+    if (n > 0) {
+        io->outpos = io->outbuf;
+        (*io->write)(io, io->outbuf, n);
+    }
+}
+
+static void *
+xmalloc(size_t n)
+{
+    void *p = malloc(n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+void
+io_init(LazyIO *io, IOReadFunc *readf, IOWriteFunc *writef, void *data,
+        size_t insize, size_t outsize)
+{
+    memset(io, 0, sizeof(*io));
+    io->read = readf;
+    io->write = writef;
+    io->data = data;
+    io->insize = insize;
+    io->inbuf = insize ? xmalloc(insize) : NULL;
+    io->outbuf = outsize ? xmalloc(outsize) : NULL;
+    io->outpos = io->outbuf;
+    io->outend = io->outbuf + outsize;
+}
+
+void
+io_release(LazyIO *io)
+{
+    free(io->inbuf);
+    free(io->outbuf);
+    io->inbuf = io->outbuf = NULL;
+}
+
+//
+// stdio; a line at a time in, so that an interactive program sees
+// each line as it is typed. Output to a terminal is not buffered
+// here, so it comes out no later than it did with putchar
+//
+static size_t
+stdio_read(LazyIO *io, unsigned char *buf, size_t len)
+{
+    size_t n = 0;
+    int c;
+
+    while (n < len && (c = getc(stdin)) != EOF) {
+        buf[n++] = c;
+        if (c == '\n') break;
+    }
+    return n;
+}
+
+static void
+stdio_write(LazyIO *io, const unsigned char *buf, size_t len)
+{
+    fwrite(buf, 1, len, stdout);
+}
+
+static unsigned char stdio_in[BUFSIZ], stdio_out[BUFSIZ];
+static LazyIO stdio_io = {
+    stdio_read, stdio_write, NULL,
+    stdio_in, sizeof(stdio_in), NULL, NULL,
+    stdio_out, stdio_out, stdio_out,
+};
+
+// until something else is chosen, unbuffered stdio
+LazyIO *gl_io = &stdio_io;
+
+LazyIO *
+io_stdio(void)
+{
+    if (!isatty(1)) {
+        stdio_io.outend = stdio_out + sizeof(stdio_out);
+    }
+    return &stdio_io;
+}
+
+//
+// file descriptors
+//
+typedef struct fd_pair {
+    int in, out;
+} FdPair;
+
+static size_t
+fd_read(LazyIO *io, unsigned char *buf, size_t len)
+{
+    FdPair *F = io->data;
+    ssize_t r;
+
+    do {
+        r = read(F->in, buf, len);
+    } while (r < 0 && errno == EINTR);
+    return r > 0 ? r : 0;
+}
+
+static void
+fd_write(LazyIO *io, const unsigned char *buf, size_t len)
+{
+    FdPair *F = io->data;
+    ssize_t r;
+
+    while (len > 0) {
+        r = write(F->out, buf, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            perror("write");
+            exit(1);
+        }
+        buf += r;
+        len -= r;
+    }
+}
+
+LazyIO *
+io_fd(int in, int out)
+{
+    LazyIO *io = xmalloc(sizeof(LazyIO));
+    FdPair *F = xmalloc(sizeof(FdPair));
+
+    F->in = in;
+    F->out = out;
+    io_init(io, fd_read, fd_write, F, FD_BUFSIZE, FD_BUFSIZE);
+    return io;
+}
+
+//
+// memory; the input buffer is read in place, and the output is
+// collected in a buffer that grows as needed
+//
+typedef struct mem_out {
+    unsigned char *buf;
+    size_t len, max;
+} MemOut;
+
+static size_t
+mem_read(LazyIO *io, unsigned char *buf, size_t len)
+{
+    return 0;
+}
+
+static void
+mem_write(LazyIO *io, const unsigned char *buf, size_t len)
+{
+    MemOut *M = io->data;
+
+    if (M->len + len > M->max) {
+        while (M->len + len > M->max) {
+            M->max = M->max ? 2 * M->max : FD_BUFSIZE;
+        }
+        M->buf = realloc(M->buf, M->max);
+        if (!M->buf) fatal("out of memory");
+    }
+    memcpy(M->buf + M->len, buf, len);
+    M->len += len;
+}
+
+LazyIO *
+io_memory(const void *input, size_t len)
+{
+    LazyIO *io = xmalloc(sizeof(LazyIO));
+    MemOut *M = xmalloc(sizeof(MemOut));
+
+    memset(M, 0, sizeof(*M));
+    io_init(io, mem_read, mem_write, M, 0, FD_BUFSIZE);
+    io->inpos = input;
+    io->inend = io->inpos + len;
+    return io;
+}
+
+const unsigned char *
+io_memory_output(LazyIO *io, size_t *len)
+{
+    MemOut *M = io->data;
+
+    io_flush(io);
+    *len = M->len;
+    return M->buf;
+}
+
+//
+// all of f, for io_memory
+//
+unsigned char *
+io_read_all(FILE *f, size_t *len)
+{
+    unsigned char *buf = NULL;
+    size_t max = 0, n;
+
+    *len = 0;
+    do {
+        if (*len == max) {
+            max = max ? 2*max : FD_BUFSIZE;
+            buf = realloc(buf, max);
+            if (!buf) fatal("out of memory");
+        }
+        n = fread(buf + *len, 1, max - *len, f);
+        *len += n;
+    } while (n > 0);
+    return buf;
+}
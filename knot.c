@@ -0,0 +1,194 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// tying the knot for recursion
+//
+// Lazier compiles recursion (and its Y combinator) to a self
+// application, ((S I I) f) where
+//   f self x1 ... xn = ... (self self) ...
+// Every time the body is unfolded (self self) is a new application
+// of f to itself, which has to be reduced all over again. If self
+// is only ever used like that, we can instead make the node into
+//   X = f (K X)
+// so that (self self) becomes ((K X) (K X)), which is X itself:
+// whatever reducing f's first argument in is done once, in X, and
+// shared by all of the unfoldings. The graph is then cyclic; the gc
+// marks each cell only once, so it doesn't care.
+//
+// We find out how f uses its first argument by applying it to
+// variables (supercomb.c) and looking at every place the first one
+// turns up in the result.
+//
+
+#include <stdlib.h>
+#include "lazy.h"
+#include "supercomb.h"
+
+// how hard to look at each function
+#define KNOT_STEPS 10000
+
+static bool *seen;
+static Cell **todo;
+static int numtodo, maxtodo;
+static Cell **found;
+static int numfound, maxfound;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+static void
+push_todo(Cell *c)
+{
+    if (!c || seen[c - mem]) return;
+    seen[c - mem] = true;
+    if (numtodo == maxtodo) {
+        maxtodo = maxtodo ? 2 * maxtodo : 1024;
+        todo = xrealloc(todo, maxtodo * sizeof(Cell *));
+    }
+    todo[numtodo++] = c;
+}
+
+static bool
+is_I(Cell *c)
+{
+    return gettype(c) == CT_NUM && getnum(c) == 1;
+}
+
+// is c (S I I), in any of the forms the parser may leave it in?
+static bool
+is_SII(Cell *c)
+{
+    if (gettype(c) == CT_S2_PAIR) {
+        return is_I(getleft(c)) && is_I(getright(c));
+    }
+    if (gettype(c) != CT_A_PAIR || !is_I(getright(c))) return false;
+    c = getleft(c);
+    if (gettype(c) == CT_FUNC) {
+        return getfunc(c) == S1_func && is_I(getarg(c));
+    }
+    return gettype(c) == CT_A_PAIR && is_I(getright(c))
+        && gettype(getleft(c)) == CT_FUNC && getfunc(getleft(c)) == S_func;
+}
+
+// if c applies something to itself, return what
+static Cell *
+self_applied(Cell *c)
+{
+    if (gettype(c) != CT_A_PAIR) return NULL;
+    if (getleft(c) == getright(c)) return getleft(c);
+    if (is_SII(getleft(c))) return getright(c);
+    return NULL;
+}
+
+static bool is_self(STerm *t) { return t->kind == ST_VAR && t->var == 0; }
+
+static void
+check_use(STerm *t, void *arg)
+{
+    if (is_self(t->fun) && is_self(t->arg)) return;
+    if (is_self(t->fun) || is_self(t->arg)) *(bool *)arg = false;
+}
+
+// does f only use its first argument as (self self)?
+static bool
+only_self_applied(Cell *f)
+{
+    Supercomb S;
+    STerm *body;
+    bool ok = false;
+    size_t mark = sc_mark();
+
+    if (sc_apply(f, &S)) {
+        body = sc_normalise(S.body, KNOT_STEPS);
+        if (body && !is_self(body)) {
+            ok = true;
+            sc_walk_body(body, check_use, &ok);
+        }
+    }
+    sc_release(mark);
+    return ok;
+}
+
+int
+tie_knots(Cell *prog)
+{
+    Cell *c, *f, *k;
+    int i;
+
+    seen = calloc(NUMCELLS, sizeof(bool));
+    if (!seen) fatal("out of memory");
+    numtodo = numfound = 0;
+    push_todo(prog);
+    while (numtodo > 0) {
+        c = todo[--numtodo];
+        f = self_applied(c);
+        if (f && only_self_applied(f)) {
+            if (numfound == maxfound) {
+                maxfound = maxfound ? 2 * maxfound : 64;
+                found = xrealloc(found, maxfound * sizeof(Cell *));
+            }
+            found[numfound++] = c;
+        }
+        switch (gettype(c)) {
+        case CT_A_PAIR:
+        case CT_S2_PAIR:
+        case CT_C2_PAIR:
+        case CT_NUM_PAIR:
+            push_todo(getleft(c));
+            push_todo(getright(c));
+            break;
+        case CT_FUNC:
+            push_todo(getarg(c));
+            break;
+        default:
+            break;
+        }
+    }
+    free(seen);
+
+    // they are all reachable from prog, so no gc can take them; but
+    // a gc may redirect their children, so we look again afterwards
+    for (i = 0; i < numfound; i++) {
+        c = found[i];
+        k = alloc_cell();
+        f = self_applied(c);
+        if (!f) continue;
+        mkfunc(k, K1_func, c);
+        setshared(k);
+        setshared(c);
+        setshared(f);
+        mkapply(c, f, k);
+    }
+    return numfound;
+}
@@ -35,6 +35,42 @@
 ;;
 
 
+; Native extensions.
+;
+; The Propeller Lazy K (and its lazy/lazys interpreters) has numbers,
+; cons and increment built in: [N] is the Church numeral N, c is
+; (lambda (x y f) (f x y)), and + adds one to something that
+; evaluates to a number. With lazier-native set (prelude-native.scm
+; does this), expand-macros keeps numeric constants as they are,
+; folds arithmetic on them, and the printers write [N], c and + for
+; them. The output is smaller and faster, but only runs here.
+
+(define lazier-native #f)
+
+; the largest number a Propeller cell can hold is 2^28-1
+(define (native-number? x)
+  (and lazier-native (integer? x) (exact? x) (>= x 0) (< x 268435456)))
+
+; try to work out (f g) at compile time, where g has been expanded
+; already; returns #f if we can't
+(define (fold-native f g expand exclude)
+  (define (op? x name)
+    (and (eq? x name) (not (memv x exclude))) )
+  (cond ((not (native-number? g)) #f)
+        ((or (op? f '1+) (op? f 'succ))
+         (and (native-number? (+ g 1)) (+ g 1)) )
+        ((and (pair? f) (not (eq? (car f) 'lambda)))
+         (let ((op (car f))
+               (a (expand (cadr f))) )
+           (and (native-number? a)
+                (let ((r (cond ((op? op '+) (+ a g))
+                               ((op? op '*) (* a g))
+                               ((op? op '^) (expt a g))
+                               (else #f) )))
+                  (and r (native-number? r) r) ))))
+        (else #f) ))
+
+
 ; lazy-def.
 
 (define lazy-defs '())
@@ -87,6 +123,7 @@
     (expr-dispatch expr
      (lambda (leaf)
        (cond ((memv leaf exclude) leaf)
+             ((native-number? leaf) leaf)
              ((memv leaf stack)
               (display "Recursion within lazy-defs detected: ")
               (display (cons leaf stack))
@@ -98,7 +135,11 @@
                     (helper (cdr def) exclude (cons leaf stack))
                     leaf )))))
      (lambda (f g)
-       (list (helper f exclude stack) (helper g exclude stack)) )
+       (let ((g: (helper g exclude stack)))
+         (or (fold-native f g:
+                          (lambda (x) (helper x exclude stack))
+                          exclude )
+             (list (helper f exclude stack) g:) )))
      (lambda (var body)
        `(lambda (,var) ,(helper body (cons var exclude) stack)) ))))
 
@@ -278,24 +319,140 @@
      `(lambda (,var) ,(unapply-s body)) )))
 
 
+; Smallest equivalent subterms.
+;
+; unabstract, apply-ski and unapply-s each look at one rule at a time.
+; With lazier-abstraction set to 'search (after loading this file),
+; laze also replaces every subterm made only of S, K and I with the
+; smallest such term that does the same thing, out of all those of up
+; to search-size combinators. Two terms do the same thing if, applied
+; to four fresh variables, they reduce to the same normal form within
+; search-fuel steps. It is slow, and saves about 1%. The abstraction
+; itself leaves little to find: Kiselyov's algorithm and Tromp's extra
+; rules both give exactly unabstract's output for the examples in eg.
+; What the search finds are things like S(KI) for I, or S(K(SI(KK)))
+; for SS(K(KK)).
+
+(define lazier-abstraction 'classic)
+
+(define search-size 5)
+(define search-fuel 200)
+(define search-steps 0)
+
+; the head of (t . args) once it can't be reduced any further, with
+; its arguments, or #f if that takes too many steps
+(define (search-whnf t args)
+  (cond ((pair? t)
+         (search-whnf (car t) (cons (cadr t) args)) )
+        ((not (memq t '(s k i)))
+         (cons t args) )
+        ((< (length args) (cdr (assq t '((i . 1) (k . 2) (s . 3)))))
+         (cons t args) )
+        ((>= search-steps search-fuel)
+         #f )
+        (else
+         (set! search-steps (+ search-steps 1))
+         (cond ((eq? t 'i)
+                (search-whnf (car args) (cdr args)) )
+               ((eq? t 'k)
+                (search-whnf (car args) (cddr args)) )
+               (else
+                (let ((x (car args))
+                      (y (cadr args))
+                      (z (caddr args)) )
+                  (search-whnf x (cons z (cons (list y z) (cdddr args)))) ))))))
+
+(define (search-normal t)
+  (let ((w (search-whnf t '())))
+    (and w
+         (let loop ((r (car w)) (args (cdr w)))
+           (if (null? args)
+               r
+               (let ((a (search-normal (car args))))
+                 (and a (loop (list r a) (cdr args))) ))))))
+
+(define (search-signature t)
+  (set! search-steps 0)
+  (search-normal (list (list (list (list t 0) 1) 2) 3)) )
+
+; the terms of each size, and for each signature the first (so
+; smallest) term found with it, as (signature size term)
+(define search-terms '())
+(define search-table '())
+
+(define (search-build)
+  (do ((n 1 (+ n 1)))
+      ((> n search-size))
+    (let ((terms
+           (if (= n 1)
+               '(s k i)
+               (let loop ((l 1) (terms '()))
+                 (if (= l n)
+                     terms
+                     (loop (+ l 1)
+                           (append terms
+                                   (apply append
+                                          (map (lambda (f)
+                                                 (map (lambda (g) (list f g))
+                                                      (list-ref search-terms (- n l 1)) ))
+                                               (list-ref search-terms (- l 1)) )))))))))
+      (set! search-terms (append search-terms (list terms)))
+      (for-each
+       (lambda (t)
+         (let ((sig (search-signature t)))
+           (if (and sig (not (assoc sig search-table)))
+               (set! search-table (cons (list sig n t) search-table)) )))
+       terms ))))
+
+(define (search-ski? expr)
+  (if (pair? expr)
+      (and (search-ski? (car expr)) (search-ski? (cadr expr)))
+      (memq expr '(s k i)) ))
+
+(define (search-smallest expr)
+  (if (null? search-table) (search-build))
+  (let self ((expr expr))
+    (if (not (pair? expr))
+        expr
+        (let ((expr (list (self (car expr)) (self (cadr expr)))))
+          (if (search-ski? expr)
+              (let* ((sig (search-signature expr))
+                     (found (and sig (assoc sig search-table))) )
+                (if (and found (< (cadr found) (expr-size expr)))
+                    (caddr found)
+                    expr ))
+              expr )))))
+
+(define (expr-size expr)
+  (if (pair? expr)
+      (+ (expr-size (car expr)) (expr-size (cadr expr)))
+      1 ))
+
+
 ; Putting it all together.
 
 (define (laze code)
-  (unapply-s (apply-ski (unabstract (apply-lambdas (expand-macros (curry-exp code)))))) )
+  (let ((expr (unapply-s (apply-ski (unabstract (apply-lambdas (expand-macros (curry-exp code))))))))
+    (if (eq? lazier-abstraction 'search)
+        (search-smallest expr)
+        expr )))
 
 
 ; Printing it out.
 
+; leaves other than s, k and i
+(define (print-leaf leaf)
+  (cond ((eq? leaf 'native-cons) (display "c"))
+        ((eq? leaf 'native-inc) (display "+"))
+        (else (display "[") (display leaf) (display "]")) ))
+
 (define (print-as-cc lazified-code)
   (let self ((code lazified-code))
     (expr-dispatch code
      (lambda (leaf)
       (if (memq leaf '(i k s))
           (display (char-upcase (string-ref (symbol->string leaf) 0)))
-          (begin
-            (display "[")
-            (display leaf)
-            (display "]") )))
+          (print-leaf leaf) ))
      (lambda (f g)
       (self f)
       (if (pair? g) (display "(") '())
@@ -314,7 +471,7 @@
         (cond ((eq? leaf 'i) (display i))
               ((eq? leaf 'k) (display k))
               ((eq? leaf 's) (display s))
-              (else (display "[") (display leaf) (display "]")) ))
+              (else (print-leaf leaf)) ))
        (lambda (f g)
         (display aply)
         (self f)
@@ -0,0 +1,16 @@
+;; Definitions that use the Propeller Lazy K's built in numbers,
+;; cons and increment. Load this after prelude.scm and
+;; prelude-numbers.scm; the output will only run on this
+;; implementation (lazy, lazys and proplazy), not on other
+;; Lazy K interpreters.
+
+(set! lazier-native #t)
+
+;;; lists
+(lazy-def '(cons x y)	'(native-cons x y))
+
+;;; numbers
+;; these force their arguments to be numbers, which for
+;; Church numerals is always possible
+(lazy-def '(1+ a)	'(native-inc ((a native-inc) 0)))
+(lazy-def '(+ a)	'(lambda (b) ((a native-inc) ((b native-inc) 0))))
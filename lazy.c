@@ -31,7 +31,11 @@
 //
 
 #include <stdlib.h>
+#include <string.h>
 #include "lazy.h"
+#if defined(INTERPRETER) && !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 #ifdef __propeller__
 //#define DEBUG_RUNTIME
@@ -49,26 +53,123 @@ Cell *g_root;
 #endif
 
 #ifdef INTERPRETER
-Cell mem[NUMCELLS];
+// page aligned so that a checkpoint can be mapped straight over it
+Cell mem[NUMCELLS] __attribute__((aligned(4096)));
+#endif
+
+// free cells come in runs of consecutive cells; the first cell of
+// each run records where the run ends (setrunend) and the next run
+// (setstack). We bump allocate from run_ptr up to run_end.
+Cell *free_list;
+static Cell *run_ptr, *run_end;
+
+// cells at or above heap_top have never been handed out; we bump
+// allocate from there before falling back to the gc, so a heap that
+// never fills up is never swept (and its pages are never touched)
+// on the Propeller the heap arrives pre-loaded by the compiler, so
+// everything has to go through the gc
+#ifdef RUNTIME
+Cell *heap_top = &mem[NUMCELLS];
+#else
+Cell *heap_top = &mem[0];
+#endif
+
+// the end of the heap; host tools may lower it below NUMCELLS, to
+// see how a program does with less memory
+#ifdef RUNTIME
+#define heap_end (&mem[NUMCELLS])
+#else
+Cell *heap_end = &mem[NUMCELLS];
 #endif
 
-static Cell *free_list;
+// cells below frozen_end are a read-only program (see freeze_heap)
+#ifdef RUNTIME
+#define frozen_end (&mem[0])
+#else
+Cell *frozen_end = &mem[0];
+#endif
+#define isfrozen(c) ((c) < frozen_end)
 
 void
 fatal(const char *msg) {
+#ifdef INTERPRETER
+    // the scheduler ends just the job that was running, if any
+    if (gl_fatal_hook) {
+        (*gl_fatal_hook)(msg);
+    }
+#endif
     putstr(msg); putstr("\r\n");
     abort();
 }
 
 // stack of roots that we may have to sweep
+#ifdef RUNTIME
 static Cell *root_stack[ROOT_STACK_SIZE];
-static int root_stack_top;
+#else
+// the scheduler (sched.c) gives each program it runs its own
+static Cell *main_root_stack[ROOT_STACK_SIZE];
+Cell **root_stack = main_root_stack;
+#endif
+int root_stack_top;
+#ifdef RUNTIME
+#define root_limit ROOT_STACK_SIZE
+#else
+// likewise for the root stack; gl_peak_roots is the deepest it got
+int root_limit = ROOT_STACK_SIZE;
+int gl_peak_roots;
+#endif
+
+#ifndef RUNTIME
+// arrays of roots registered by host tools (e.g. the constants
+// referred to by compiled code)
+#define MAX_ROOT_RANGES 8
+static struct root_range {
+    Cell **roots;
+    int count;
+} root_ranges[MAX_ROOT_RANGES];
+static int num_root_ranges;
+
+void add_roots(Cell **roots, int count)
+{
+    if (num_root_ranges >= MAX_ROOT_RANGES) {
+        fatal("too many root ranges");
+    }
+    root_ranges[num_root_ranges].roots = roots;
+    root_ranges[num_root_ranges].count = count;
+    num_root_ranges++;
+}
+#endif
+
+#ifndef RUNTIME
+// statistics
+unsigned long gl_reductions;
+unsigned long gl_gcs;
+unsigned long gl_peak_live;
+unsigned long gl_live;
+
+// called at the start of each gc, to mark roots we don't know about
+void (*gl_gc_hook)(void);
+static unsigned long gl_marked;
+#endif
+
+#ifdef INTERPRETER
+// gl_slice_hook is called when gl_reductions reaches gl_slice_end
+unsigned long gl_slice_end;
+void (*gl_slice_hook)(void);
+// gl_fatal_hook is called by fatal, and doesn't return if it can recover
+void (*gl_fatal_hook)(const char *msg);
+#endif
 
 void push_root(Cell *x) {
-    if (root_stack_top >= ROOT_STACK_SIZE) {
+    if (root_stack_top >= root_limit) {
         fatal("root stack overflow");
     }
     root_stack[root_stack_top++] = x;
+#ifndef RUNTIME
+    if (root_stack_top > gl_peak_roots) {
+        gl_peak_roots = root_stack_top;
+    }
+#endif
 }
 Cell * pop_root() {
     Cell *x;
@@ -82,41 +183,172 @@ Cell * pop_root() {
 }
 
 
+//
+// selector thunks
+// (i x) is x, and car and cdr of a cons that has already been
+// evaluated, ((C2 x y) K) and ((C2 x y) KI), are x and y.
+// A cons may also still be in its S form (see below). An
+// unevaluated one keeps the whole cons alive (and so, often, a
+// whole list that has been read past), so the gc points anything
+// that refers to one at what it would evaluate to instead.
+// The thunk itself is still marked, and goes at the next gc: the
+// evaluator may be holding on to it in a local variable.
+//
+#define MAX_SHORTCUT 64
+
+static bool
+is_second(Cell *f)
+{
+    CellFunc *fn;
+
+    if (gettype(f) == CT_NUM) return getnum(f) == 0;
+    if (gettype(f) != CT_FUNC) return false;
+    fn = getfunc(f);
+    if (fn == KI_func) return true;
+    // (K i)
+    return fn == K1_func && gettype(getarg(f)) == CT_NUM && getnum(getarg(f)) == 1;
+}
+
+// is c (K1 x)?
+static bool
+is_const(Cell *c)
+{
+    return gettype(c) == CT_FUNC && getfunc(c) == K1_func;
+}
+
+static Cell *
+shortcut(Cell *c)
+{
+    Cell *f, *x, *car, *cdr;
+    int n;
+
+    for (n = 0; n < MAX_SHORTCUT && gettype(c) == CT_A_PAIR; n++) {
+        f = getleft(c);
+        x = getright(c);
+        if (gettype(f) == CT_NUM && getnum(f) == 1) {
+            c = x;
+            continue;
+        }
+        if (is_const(f)) {
+            // ((K1 y) x) is y; x may never be needed
+            c = getarg(f);
+            continue;
+        }
+        if (gettype(f) == CT_C2_PAIR) {
+            car = getleft(f);
+            cdr = getright(f);
+        } else if (gettype(f) == CT_S2_PAIR
+                   && gettype(getleft(f)) == CT_S2_PAIR
+                   && gettype(getleft(getleft(f))) == CT_NUM
+                   && getnum(getleft(getleft(f))) == 1
+                   && is_const(getright(getleft(f)))
+                   && is_const(getright(f))) {
+            // ((S (S i (K car))) (K cdr)), which is how lazier
+            // compiles a cons
+            car = getarg(getright(getleft(f)));
+            cdr = getarg(getright(f));
+        } else {
+            break;
+        }
+        if (gettype(x) == CT_FUNC && getfunc(x) == K_func) {
+            c = car;
+        } else if (is_second(x)) {
+            c = cdr;
+        } else {
+            break;
+        }
+    }
+    return c;
+}
+
+static void gc_mark(Cell *root);
+
+// if c is a selector thunk, mark it and return what it selects
+// (or with -D, if it is a copy of a value, the value's shared copy)
+static Cell *
+redirect(Cell *c)
+{
+    Cell *to;
+
+    if (c && gettype(c) == CT_A_PAIR) {
+        to = shortcut(c);
+        if (to != c) {
+            gc_mark(c);
+            addref(to);
+            return to;
+        }
+    }
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+    else if (c && gl_dedup) {
+        to = dedup(c);
+        if (to != c) {
+            gc_mark(c);
+            return to;
+        }
+    }
+#endif
+    return c;
+}
+
+static Cell *
+mark_child(Cell *c)
+{
+    c = redirect(c);
+    gc_mark(c);
+    return c;
+}
+
+//
+// the last child of each cell (often the rest of a list) is marked
+// by going round the loop again rather than by recursion, so that
+// the C stack only grows with the depth of left hand sides
+//
 static void
 gc_mark(Cell *root)
 {
-    CellType t;
-    Cell *left, *right;
-    Cell *arg;
-
-    if (!root) return;
-    if (getused(root)) return;
+    Cell *next;
 
-    setused(root, true);
-    t = gettype(root);
+    for (;;) {
+        if (!root) return;
+        if (getused(root) || isfrozen(root)) return;
 
-    switch(t) {
-    case CT_A_PAIR:
-    case CT_S2_PAIR:
-    case CT_NUM_PAIR:
-    case CT_C2_PAIR:
-        left = getleft(root);
-        right = getright(root);
-        if (left) gc_mark(left);
-        if (right) gc_mark(right);
-        return;
-    case CT_FUNC:
-        arg = getarg(root);
-        if (arg) gc_mark(arg);
-        return;
-    default:
-        return;
+        setused(root, true);
+#ifndef RUNTIME
+        gl_marked++;
+#endif
+        switch(gettype(root)) {
+        case CT_A_PAIR:
+        case CT_S2_PAIR:
+        case CT_NUM_PAIR:
+        case CT_C2_PAIR:
+            setleft(root, mark_child(getleft(root)));
+            next = redirect(getright(root));
+            setright(root, next);
+            break;
+        case CT_FUNC:
+            next = redirect(getarg(root));
+            setarg(root, next);
+            break;
+        default:
+            return;
+        }
+        root = next;
     }
 }
 
 // in general we shouldn't have many cells allocated but not yet
-// assigned types
-#define MAX_PENDING 8
+// assigned types (compiled supercombinators allocate a whole body
+// before filling it in, which is the most we expect)
+#define MAX_PENDING 32
+
+// add the free cells from lo up to (not including) hi to the free list
+static void
+add_run(Cell *lo, Cell *hi)
+{
+    setrunend(lo, hi);
+    setstack(lo, free_list);
+    free_list = lo;
+}
 
 static void
 gc_sweep(void)
@@ -124,30 +356,175 @@ gc_sweep(void)
     int i;
     bool used;
     Cell *cur;
+    Cell *run_hi = NULL;
     int pending_count = 0;
+#ifndef RUNTIME
+    unsigned long live_count = 0;
+#endif
 
     free_list = NULL;
+    run_ptr = run_end = NULL;
     // count down so that the free list starts at the bottom of
     // memory; this makes optimizing the compiler output easier
-    for (i = NUMCELLS-1; i >= 0; --i) {
+    for (i = (heap_top - &mem[0])-1; i >= frozen_end - &mem[0]; --i) {
         cur = &mem[i];
         used = getused(cur);
-        if (used) {
-            setused(cur, false); // in preparation for the next mark round
-        } else if (ispending(cur)) {
-            // allocated but not yet used; do not reclaim it
-            pending_count++;
+        if (used || ispending(cur)) {
+            if (used) {
+                setused(cur, false); // in preparation for the next mark round
+#ifndef RUNTIME
+                live_count++;
+#endif
+            } else {
+                // allocated but not yet used; do not reclaim it
+                pending_count++;
+            }
+            if (run_hi) {
+                add_run(cur+1, run_hi);
+                run_hi = NULL;
+            }
         } else {
-            // add to free list
+            // free; start a new run or extend the current one down
 	    settype(cur, CT_FREE);
-            setstack(cur, free_list);
-            free_list = cur;
+            if (!run_hi) run_hi = cur+1;
         }
     }
+    if (run_hi) {
+        add_run(frozen_end, run_hi);
+    }
     if (pending_count > MAX_PENDING) {
         fatal("unexpectedly high number of pending cells in gc");
     }
+#ifndef RUNTIME
+    gl_gcs++;
+    gl_live = live_count + pending_count;
+    if (gl_live > gl_peak_live) {
+        gl_peak_live = gl_live;
+    }
+#endif
+}
+
+#ifndef RUNTIME
+//
+// mark from some roots, returning how many cells that newly marked
+//
+unsigned long gc_mark_roots(Cell **roots, int count)
+{
+    unsigned long before = gl_marked;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        gc_mark(roots[i]);
+    }
+    return gl_marked - before;
 }
+#endif
+
+#ifndef RUNTIME
+//
+// frozen programs
+//
+// freeze_heap makes the cells in use so far (the parsed program) a
+// read-only region shared by everything that runs it: the forked
+// jobs of the batch server never write to its pages, and the
+// scheduler's jobs all use the one copy instead of parsing their own.
+// Nothing may be written to a frozen cell, so they are all marked
+// shared (addref then leaves them alone), the gc neither marks nor
+// sweeps them, and partial_eval reduces a private copy of a frozen
+// apply node instead of the node itself.
+//
+// Each graph being reduced keeps its copies in a thaw map, so that a
+// frozen node is still only evaluated once. The map doesn't keep its
+// copies alive, though: a copy nothing else uses any more goes at the
+// next gc, as the node would have if it weren't frozen (if it's
+// needed again, it's evaluated again). Frozen cells only ever point
+// to other frozen cells, and the program is pure until it's applied
+// to its input, so that is always safe.
+//
+struct thaw_map {
+    Cell **copy;            // indexed by frozen cell
+    int *used;              // the indices we have copies for
+    int numused, maxused;
+    ThawMap *next;
+};
+
+static ThawMap *thaw_maps;
+ThawMap *gl_thaw;
+
+ThawMap *
+new_thaw_map(void)
+{
+    ThawMap *m = calloc(1, sizeof(ThawMap));
+
+    if (!m) fatal("out of memory");
+    m->copy = calloc(frozen_end - &mem[0], sizeof(Cell *));
+    if (!m->copy) fatal("out of memory");
+    m->next = thaw_maps;
+    thaw_maps = m;
+    return m;
+}
+
+void
+free_thaw_map(ThawMap *m)
+{
+    ThawMap **p;
+
+    for (p = &thaw_maps; *p != m; p = &(*p)->next)
+        ;
+    *p = m->next;
+    free(m->copy);
+    free(m->used);
+    free(m);
+}
+
+//
+// the private copy of frozen apply node c
+//
+static Cell *
+thaw(Cell *c)
+{
+    ThawMap *m = gl_thaw;
+    int i = c - &mem[0];
+    Cell *t = m->copy[i];
+
+    if (t) {
+        return t;
+    }
+    t = alloc_cell();
+    mkapply(t, getleft(c), getright(c));
+    // it isn't only referred to by its parent, so it mustn't be reclaimed
+    setshared(t);
+    if (m->numused == m->maxused) {
+        m->maxused = m->maxused ? 2*m->maxused : 1024;
+        m->used = realloc(m->used, m->maxused * sizeof(int));
+        if (!m->used) fatal("out of memory");
+    }
+    m->used[m->numused++] = i;
+    m->copy[i] = t;
+    return t;
+}
+
+// forget the copies the gc didn't find in use
+static void
+sweep_thaw_maps(void)
+{
+    ThawMap *m;
+    int i, j, n;
+
+    for (m = thaw_maps; m; m = m->next) {
+        n = 0;
+        for (j = 0; j < m->numused; j++) {
+            i = m->used[j];
+            if (getused(m->copy[i])) {
+                m->used[n++] = i;
+            } else {
+                m->copy[i] = NULL;
+            }
+        }
+        m->numused = n;
+    }
+}
+#endif
 
 //
 // garbage collection function
@@ -156,15 +533,100 @@ void gc(void)
 {
     int i;
 
+#ifndef RUNTIME
+    if (gl_gc_hook) {
+        (*gl_gc_hook)();
+    }
+#endif
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+    if (gl_dedup) {
+        dedup_begin();
+    }
+#endif
     gc_mark(g_root);
     for (i = 0; i < root_stack_top; i++) {
         gc_mark(root_stack[i]);
     }
+#ifndef RUNTIME
+    {
+        int j;
+        for (j = 0; j < num_root_ranges; j++) {
+            for (i = 0; i < root_ranges[j].count; i++) {
+                gc_mark(root_ranges[j].roots[i]);
+            }
+        }
+    }
+    sweep_thaw_maps();
+#endif
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+    if (gl_memo) {
+        memo_sweep();
+    }
+#endif
     gc_sweep();
 }
 
-Cell *alloc_cell() {
+#ifndef RUNTIME
+//
+// make everything in use now (in practice, the program hanging off
+// g_root and the roots) a frozen program; the unused cells below the
+// highest one in use are lost
+//
+void
+freeze_heap(void)
+{
+    Cell *c;
+    size_t len;
+
+    if (frozen_end != &mem[0]) {
+        fatal("the heap is already frozen");
+    }
+    gc();
+    while (heap_top > &mem[0] && gettype(heap_top - 1) == CT_FREE) {
+        heap_top--;
+    }
+    for (c = &mem[0]; c < heap_top; c++) {
+        if (gettype(c) != CT_FREE) {
+            setshared(c);
+        }
+    }
+    // the region ends on a page boundary, so we can protect it
+    len = (heap_top - &mem[0]) * sizeof(Cell);
+    len = (len + 4095) & ~(size_t)4095;
+    heap_top = &mem[(len + sizeof(Cell) - 1) / sizeof(Cell)];
+    frozen_end = heap_top;
+    free_list = NULL;
+    run_ptr = run_end = NULL;
+#if defined(INTERPRETER) && !defined(_WIN32)
+    if (len > 0 && mprotect(mem, len, PROT_READ) != 0) {
+        fatal("unable to protect the frozen program");
+    }
+#endif
+    gl_thaw = new_thaw_map();
+}
+#endif
+
+// never used cells are handed out from heap_top this many at a time
+#define HEAP_CHUNK 4096
+
+//
+// find a new run to allocate from
+//
+static void
+next_run(void)
+{
     Cell *next = free_list;
+
+    if (!next && heap_top < heap_end) {
+        run_ptr = heap_top;
+        if (heap_end - heap_top > HEAP_CHUNK) {
+            heap_top += HEAP_CHUNK;
+        } else {
+            heap_top = heap_end;
+        }
+        run_end = heap_top;
+        return;
+    }
     if (!next) {
         gc();
         next = free_list;
@@ -174,10 +636,42 @@ Cell *alloc_cell() {
     }
     assert(gettype(next) == CT_FREE);
     free_list = getstack(next);
+    run_ptr = next;
+    run_end = getrunend(next);
+}
+
+Cell *alloc_cell() {
+    Cell *next;
+
+    if (run_ptr == run_end) {
+        next_run();
+    }
+    next = run_ptr++;
     setpending(next);
+    clearrefs(next);
     return next;
 }
 
+//
+// allocate n cells at once; if the current run has room they are
+// next to each other
+//
+void alloc_cells(Cell **cells, int n) {
+    int i;
+
+    if (run_end - run_ptr < n) {
+        for (i = 0; i < n; i++) {
+            cells[i] = alloc_cell();
+        }
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        cells[i] = run_ptr++;
+        setpending(cells[i]);
+        clearrefs(cells[i]);
+    }
+}
+
 //
 // make a cell into a number
 //
@@ -197,6 +691,8 @@ mkpair(Cell *c, Cell *X, Cell *Y, CellType t)
     settype(c, t);
     setleft(c, X);
     setright(c, Y);
+    if (X) addref(X);
+    if (Y) addref(Y);
 }
 
 //
@@ -208,6 +704,7 @@ mkfunc(Cell *c, CellFunc *func, Cell *arg)
     settype(c, CT_FUNC);
     setfunc(c, func);
     setarg(c, arg);
+    if (arg) addref(arg);
 }
 
 //
@@ -322,12 +819,18 @@ Cell *
 apply_C2(Cell *r, Cell *self, Cell *f)
 {
     Cell *A;
-    Cell *x = getleft(self);
-    Cell *y = getright(self);
 
+    // car and cdr just pick one out
+    if (gettype(f) == CT_FUNC && getfunc(f) == K_func) {
+        return getleft(self);
+    }
+    if (is_second(f)) {
+        return getright(self);
+    }
     A = alloc_cell();
-    mkapply(A, f, x);
-    mkapply(r, A, y);
+    // (the gc may have changed self while we allocated)
+    mkapply(A, f, getleft(self));
+    mkapply(r, A, getright(self));
     return r;
 }
 
@@ -342,20 +845,37 @@ Read_func(Cell *r, Cell *self, Cell *rhs)
     Cell *getresult;
     Cell *apply;
     Cell *readf;
+    Cell *cells[3];
 
 #ifdef DBUG_RUNTIME
     putstr("Read_func\r\n");
+#endif
+#ifdef INTERPRETER
+    // by default a checkpoint is taken just before the first read
+    if (gl_checkpoint_file && gl_checkpoint_at == 0) {
+        checkpoint_write(gl_checkpoint_file);
+    }
+    // the checkpoint this run was resumed from had read these already
+    for (; gl_input_skip > 0; gl_input_skip--) {
+        if (getch() < 0) break;
+    }
 #endif
     c = getch();
     if (c < 0) c = 256;
+#ifdef INTERPRETER
+    else gl_input_read++;
+#endif
+    // the scheduler may have run gcs while we waited for input
+    rhs = getright(r);
 #ifdef DEBUG_RUNTIME
     putstr("Read_func got: ");
     puthex(c);
     putstr("\r\n");
 #endif
-    getresult = alloc_cell();
-    apply = alloc_cell();
-    readf = alloc_cell();
+    alloc_cells(cells, 3);
+    getresult = cells[0];
+    apply = cells[1];
+    readf = cells[2];
 
     // Cons_func allocates memory,
     // so we can't set the types
@@ -403,6 +923,7 @@ apply_NumPair(Cell *r, Cell *self, Cell *rhs)
   Cell *N = getleft(self);
   Cell *F = getright(self);
   Cell *Asub, *N_1_x, *N_1;
+  Cell *cells[3];
   int n;
 
   if (gettype(N) != CT_NUM) {
@@ -428,9 +949,11 @@ apply_NumPair(Cell *r, Cell *self, Cell *rhs)
     mkapply(r, F, rhs);
     return r;
   }
-  Asub =  alloc_cell();
-  N_1_x = alloc_cell();
-  N_1 = alloc_cell();
+  alloc_cells(cells, 3);
+  F = getright(self);
+  Asub = cells[0];
+  N_1_x = cells[1];
+  N_1 = cells[2];
   mknum(N_1, n-1);
   mknumpair(N_1_x, N_1, F);
   mkapply(Asub, N_1_x, rhs);
@@ -447,9 +970,11 @@ apply_S2(Cell *r, Cell *self, Cell *z)
 {
   Cell *A1, *A2;
     Cell *x, *y;
+    Cell *cells[2];
 
-    A1 = alloc_cell();
-    A2 = alloc_cell();
+    alloc_cells(cells, 2);
+    A1 = cells[0];
+    A2 = cells[1];
 
     x = getleft(self);
     y = getright(self);
@@ -458,6 +983,8 @@ apply_S2(Cell *r, Cell *self, Cell *z)
     mkapply(A2, y, z);
     setleft(r, A1);
     setright(r, A2);
+    addref(A1);
+    addref(A2);
     return r;
 }
 
@@ -502,13 +1029,64 @@ partial_apply_primitive(Cell *A)
     return (*f)(A, lhs, rhs);
 }
 
+#ifndef RUNTIME
+//
+// eager reclamation: cells that we know have just become garbage
+// go straight back on the free list, instead of waiting for the gc
+//
+static void
+free_cell(Cell *c)
+{
+    settype(c, CT_FREE);
+    add_run(c, c+1);
+}
+
+//
+// the apply node A, with lhs on its left, has just been reduced to
+// res; if nothing else pointed at the cells that were used up, free
+// them. If A was overwritten, the reference it held to lhs has gone.
+// If not, A itself is garbage when the only pointer to it was the
+// one from the spine node above (which now points at res); A is
+// never the top node here, since our caller still holds that.
+//
+static void
+reclaim(Cell *A, Cell *lhs, Cell *res)
+{
+    if (res != A) {
+        if (!isunique(A) || gettype(A) != CT_A_PAIR || getleft(A) != lhs) {
+            return;
+        }
+        free_cell(A);
+    }
+    if (isunique(lhs)) {
+        // a numeral that was only used to count down
+        if (gettype(lhs) == CT_NUM_PAIR && isunique(getleft(lhs))) {
+            free_cell(getleft(lhs));
+        }
+        free_cell(lhs);
+    }
+}
+#endif
+
 Cell *
 partial_eval(Cell *node)
 {
     Cell *prev;
     Cell *lhs;
     Cell *cur;
+#ifndef RUNTIME
+    Cell *A;
+    int base;
+#endif
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+    MemoFrame frames[MEMO_FRAMES];
+    int nframes = 0;
+    Cell *hit;
+#endif
 
+#ifndef RUNTIME
+    base = root_stack_top;
+#endif
     push_root(node);
 
     cur = node;
@@ -516,10 +1094,32 @@ partial_eval(Cell *node)
 
     for(;;) {
         while (gettype(cur) == CT_A_PAIR) {
+#ifndef RUNTIME
+            if (isfrozen(cur)) {
+                cur = thaw(cur);
+                if (prev) {
+                    setleft(prev, cur);
+                    addref(cur);
+                } else {
+                    // the top node; keep the copy alive instead
+                    root_stack[base] = cur;
+                }
+                // which may have been evaluated already
+                continue;
+            }
+#endif
 	    push_root(prev);
             prev = cur;
             cur = getleft(cur);
         }
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+        // cur is the result of any application waiting at this point
+        // in the spine
+        while (nframes > 0 && frames[nframes-1].depth == root_stack_top
+               && frames[nframes-1].parent == prev) {
+            memo_finish(&frames[--nframes], cur);
+        }
+#endif
         if (!prev) break;
         // lhs is not an A_PAIR, so apply it to the rhs of prev
         lhs = cur;
@@ -528,11 +1128,47 @@ partial_eval(Cell *node)
 
         assert(lhs == getleft(cur));
         assert( prev == 0 || cur == getleft(prev));
+#ifdef INTERPRETER
+        if (++gl_reductions == gl_checkpoint_at) {
+            checkpoint_write(gl_checkpoint_file);
+        }
+        if (gl_reductions == gl_slice_end) {
+            // other programs' gcs may short circuit the only
+            // pointer to cur (see shortcut)
+            push_root(cur);
+            (*gl_slice_hook)();
+            pop_root();
+        }
+#elif !defined(RUNTIME)
+        ++gl_reductions;
+#endif
+#ifndef RUNTIME
+        A = cur;
+#endif
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+        if (gl_memo && memoizable(lhs)) {
+            hit = memo_lookup(lhs, getright(cur));
+            if (hit) {
+                cur = hit;
+            } else {
+                if (nframes < MEMO_FRAMES) {
+                    memo_start(&frames[nframes++], root_stack_top, prev, lhs, getright(cur));
+                }
+                cur = partial_apply_primitive(cur);
+            }
+        } else
+#endif
         cur = partial_apply_primitive(cur);
 	//make sure it goes in the tree
 	if (prev) {
 	  setleft(prev, cur);
+	  addref(cur);
 	}
+#ifndef RUNTIME
+        if (prev || cur == A) {
+            reclaim(A, lhs, cur);
+        }
+#endif
     }
 
     pop_root();
@@ -605,9 +1241,20 @@ eval_loop()
 
     for(;;) {
         g_root = partial_eval(g_root);
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+        if (gettype(g_root) == CT_FUNC && getfunc(g_root) == Str_func) {
+            g_root = put_string(g_root);
+            continue;
+        }
+#endif
+        // g_root is used again after car(g_root) has been evaluated
+        setshared(g_root);
         head = car(g_root);
         outc = getintvalue(head);
         if (outc >= 256) {
+#ifndef __propeller__
+            io_flush(gl_io);
+#endif
             return outc - 256;
         }
         putch(outc);
@@ -629,26 +1276,387 @@ main(int argc, char **argv)
     return eval_loop(g_root);
 }
 #endif
-#ifdef INTERPRETER
+#if defined(INTERPRETER) && !defined(HOST_TOOL)
+static const char *gl_name = "lazy";
+
+bool gl_freeze;
+// pack_strings and tie_knots have nothing like them on the Propeller,
+// so they are left out where lazy is standing in for it
+#ifdef SMALL
+bool gl_host_passes = false;
+#else
+bool gl_host_passes = true;
+#endif
+
+//
+// parse a program and get it ready to run
+//
+Cell *
+prepare_program(const char *text, bool optimize, bool gmachine)
+{
+#ifdef SMALL
+    gl_optimize = true;
+#endif
+    if (optimize) {
+        gl_optimize = true;
+    }
+    g_root = parse_text(text);
+    if (optimize) {
+        g_root = prenorm(g_root, false);
+    }
+    if (gl_host_passes) {
+        tie_knots(g_root);
+        // a checkpoint only has the heap, not the text of the strings
+        if (!gl_checkpoint_file) {
+            pack_strings(g_root);
+        }
+    }
+    if (gmachine) {
+        gm_compile(g_root);
+    }
+    if (gl_freeze) {
+        freeze_heap();
+    }
+    if (heap_top > gl_program_end) {
+        gl_program_end = heap_top;
+    }
+    return g_root;
+}
+
+//
+// and apply it to the input
+//
+Cell *
+load_program(const char *text, bool optimize, bool gmachine)
+{
+    return apply_input(prepare_program(text, optimize, gmachine));
+}
+
+//
+// with -v
+//
+static void
+report_stats(void)
+{
+    fprintf(stderr, "lazy: %lu reductions, %lu gcs, %lu cells in use at most\n",
+            gl_reductions, gl_gcs, gl_peak_live);
+}
+
+// the default -l, so that no one scheduled job can take the whole
+// heap; the Propeller's heap is too small to split, as the bigger
+// examples need most of it
+#ifdef SMALL
+#define DEFAULT_MAXCELLS 0
+#else
+#define DEFAULT_MAXCELLS (NUMCELLS / 4)
+#endif
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "Usage: %s [-O][-G][-F][-D][-M][-v][-p patterns][-c ckpt [-n count]][-i io] file.lazy\n", gl_name);
+    fprintf(stderr, "       %s -I [-O][-v][-p patterns][-i io] file.lazy\n", gl_name);
+    fprintf(stderr, "       %s [-O][-G][-F][-D][-M][-p patterns][-j n] {-d spooldir [-w] | -f} file.lazy\n", gl_name);
+    fprintf(stderr, "       %s [-F [-O][-G]][-D][-M][-p patterns] {-s | -u socket} [-j n][-q n][-m n][-l n] file.lazy\n", gl_name);
+    fprintf(stderr, "       %s [-O][-G][-F][-D][-M][-p patterns][-j n] -b outdir file.lazy [input...]\n", gl_name);
+    fprintf(stderr, "       %s -r ckpt [-D][-M][-i io | -j n {-d spooldir [-w] | -f | -b outdir [input...]}]\n", gl_name);
+    fprintf(stderr, "       %s -a [-O][-G][-F][-D][-M][-p patterns] file.lazy < input\n", gl_name);
+    fprintf(stderr, "  -O:     optimize, and reduce the program before running it\n");
+    fprintf(stderr, "  -G:     compile the program's supercombinators to G-machine code\n");
+    fprintf(stderr, "  -F:     make the program read-only, shared by every job that runs it\n");
+    fprintf(stderr, "  -D:     have the gc share equal numbers, partial applications and conses\n");
+    fprintf(stderr, "  -M:     remember the results of applying shared functions\n");
+    fprintf(stderr, "  -I:     reduce an interaction net in optimal order, not the graph\n");
+    fprintf(stderr, "          (memory grows with the output, so only for short runs)\n");
+    fprintf(stderr, "  -v:     print how many reductions it took at the end\n");
+    fprintf(stderr, "  -p file: also replace the patterns listed in file while parsing\n");
+    fprintf(stderr, "  -c ckpt: write a checkpoint to ckpt at the first read, and exit\n");
+    fprintf(stderr, "  -n count: take the checkpoint after count reductions instead\n");
+    fprintf(stderr, "  -r ckpt: resume from checkpoint ckpt instead of parsing a file\n");
+    fprintf(stderr, "  -i io:  do I/O with stdio (the default), fd (read and write, with\n");
+    fprintf(stderr, "          large buffers) or mem (all of stdin first, output at the end)\n");
+    fprintf(stderr, "  -d dir: serve jobs from spool directory dir\n");
+    fprintf(stderr, "  -w:     keep watching the spool directory for new jobs\n");
+    fprintf(stderr, "  -f:     serve length-framed jobs from stdin\n");
+    fprintf(stderr, "  -b dir: run each input file (named on stdin if none are given),\n");
+    fprintf(stderr, "          writing the output for path/name to dir/path/name.out\n");
+    fprintf(stderr, "  -j n:   run at most n jobs at once (default 1, or 64 with -s)\n");
+    fprintf(stderr, "  -s:     like -f, but run the jobs as coroutines in this process\n");
+    fprintf(stderr, "  -u path: serve each connection to Unix socket path as a job, as with -s\n");
+    fprintf(stderr, "  -q n:   with -s or -u, switch jobs every n reductions (default 10000)\n");
+    fprintf(stderr, "  -m n:   with -s or -u, stop a job after n reductions\n");
+    fprintf(stderr, "  -l n:   with -s or -u, stop a job that uses more than n cells\n");
+#if DEFAULT_MAXCELLS
+    fprintf(stderr, "          (default a quarter of the heap)\n");
+#endif
+    fprintf(stderr, "  -a:     find the smallest heap and root stack the program needs\n");
+    exit(2);
+}
+
 int
 main(int argc, char **argv)
 {
     FILE *f;
+    const char *spooldir = NULL;
+    const char *batchdir = NULL;
+    const char *resume = NULL;
+    bool frames = false;
+    bool watch = false;
+    bool optimize = false;
+    bool gmachine = false;
+    bool sched = false;
+    bool capacity = false;
+    bool inet = false;
+    bool verbose = false;
+    const char *sockpath = NULL;
+    unsigned long quantum = 10000;
+    unsigned long maxfuel = 0;
+    unsigned long maxcells = 0;
+    int maxjobs = 0;
+    const char *io = NULL;
+    int rc;
+
+    gl_name = argv[0];
+    argv++; --argc;
+    while (argv[0] && argv[0][0] == '-') {
+        switch (argv[0][1]) {
+        case 'd':
+            if (!argv[1]) Usage();
+            spooldir = argv[1];
+            argv++; --argc;
+            break;
+        case 'f':
+            frames = true;
+            break;
+        case 'b':
+            if (!argv[1]) Usage();
+            batchdir = argv[1];
+            argv++; --argc;
+            break;
+        case 'O':
+            optimize = true;
+            break;
+        case 'G':
+            gmachine = true;
+            break;
+        case 'a':
+            capacity = true;
+            break;
+        case 'F':
+            gl_freeze = true;
+            break;
+        case 'D':
+            gl_dedup = true;
+            break;
+        case 'M':
+            gl_memo = true;
+            atexit(memo_report);
+            break;
+        case 'I':
+            inet = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'p':
+            if (!argv[1]) Usage();
+            load_patterns(argv[1]);
+            gl_optimize = true;
+            argv++; --argc;
+            break;
+        case 'c':
+            if (!argv[1]) Usage();
+            gl_checkpoint_file = argv[1];
+            argv++; --argc;
+            break;
+        case 'n':
+            if (!argv[1]) Usage();
+            gl_checkpoint_at = strtoul(argv[1], NULL, 0);
+            if (gl_checkpoint_at == 0) Usage();
+            argv++; --argc;
+            break;
+        case 'r':
+            if (!argv[1]) Usage();
+            resume = argv[1];
+            argv++; --argc;
+            break;
+        case 'w':
+            watch = true;
+            break;
+        case 'i':
+            if (!argv[1]) Usage();
+            io = argv[1];
+            if (strcmp(io, "stdio") && strcmp(io, "fd") && strcmp(io, "mem")) {
+                Usage();
+            }
+            argv++; --argc;
+            break;
+        case 'j':
+            if (!argv[1]) Usage();
+            maxjobs = atoi(argv[1]);
+            if (maxjobs < 1) Usage();
+            argv++; --argc;
+            break;
+        case 's':
+            sched = true;
+            break;
+        case 'u':
+            if (!argv[1]) Usage();
+            sockpath = argv[1];
+            sched = true;
+            argv++; --argc;
+            break;
+        case 'q':
+            if (!argv[1]) Usage();
+            quantum = strtoul(argv[1], NULL, 0);
+            if (quantum == 0) Usage();
+            argv++; --argc;
+            break;
+        case 'm':
+            if (!argv[1]) Usage();
+            maxfuel = strtoul(argv[1], NULL, 0);
+            argv++; --argc;
+            break;
+        case 'l':
+            if (!argv[1]) Usage();
+            maxcells = strtoul(argv[1], NULL, 0);
+            argv++; --argc;
+            break;
+        default:
+            Usage();
+            break;
+        }
+        argv++; --argc;
+    }
+    if (gl_checkpoint_at && !gl_checkpoint_file) {
+        Usage();
+    }
+    // the other modes have their own idea of where I/O goes
+    if (io && (capacity || sched || spooldir || frames || batchdir)) {
+        Usage();
+    }
+    if (batchdir && (capacity || sched || spooldir || frames)) {
+        Usage();
+    }
+    // the net engine has none of the graph's machinery
+    if (inet && (capacity || sched || spooldir || frames || batchdir || resume
+                 || gl_checkpoint_file || gmachine || gl_freeze || gl_dedup || gl_memo)) {
+        Usage();
+    }
+    if (verbose) {
+        atexit(inet ? inet_report : report_stats);
+    }
+    if (capacity) {
+        // every run parses its own copy of the program, too
+        if (argc != 1 || sched || resume || gl_checkpoint_file || spooldir || frames || maxjobs) {
+            Usage();
+        }
+        f = fopen(argv[0], "r");
+        if (!f) {
+            perror(argv[0]);
+            return 1;
+        }
+        {
+            const char *prog = alloc_file(f);
+            fclose(f);
+            return plan_capacity(prog, optimize, gmachine);
+        }
+    }
+    if (sched) {
+        // every job parses its own copy of the program, unless they
+        // can all share a frozen one
+        if (argc != 1 || resume || gl_checkpoint_file || spooldir) {
+            Usage();
+        }
+        if ((optimize || gmachine) && !gl_freeze) {
+            Usage();
+        }
+        f = fopen(argv[0], "r");
+        if (!f) {
+            perror(argv[0]);
+            return 1;
+        }
+        {
+            const char *prog = alloc_file(f);
+            fclose(f);
+            if (gl_freeze) {
+                gl_shared_prog = prepare_program(prog, optimize, gmachine);
+            }
+            if (maxjobs == 0) {
+                maxjobs = 64;
+            }
+            if (maxcells == 0) {
+                maxcells = DEFAULT_MAXCELLS;
+            }
+            if (sockpath) {
+                return serve_socket(sockpath, prog, maxjobs, quantum, maxfuel, maxcells);
+            }
+            return serve_sched(prog, maxjobs, quantum, maxfuel, maxcells);
+        }
+    }
+    // the compiled code lives outside the heap, so can't be saved
+    if (gmachine && (resume || gl_checkpoint_file)) {
+        Usage();
+    }
+    if (resume) {
+        // the program and its input are all mixed up by now
+        if ((argc != 0 && !batchdir) || gl_checkpoint_file || gl_freeze) {
+            Usage();
+        }
+        checkpoint_restore(resume);
+    } else {
+        // in batch mode the input files follow the program
+        if (argc != 1 && !(batchdir && argc > 1)) {
+            Usage();
+        }
+        f = fopen(argv[0], "r");
+        if (!f) {
+            perror(argv[0]);
+            return 1;
+        }
+        if (inet) {
+            inet_load(alloc_file(f), optimize);
+        } else {
+            g_root = load_program(alloc_file(f), optimize, gmachine);
+        }
+        fclose(f);
+        argv++; --argc;
+    }
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s file.lazy\n", argv[0]);
-        return 2;
+    if (maxjobs == 0) {
+        maxjobs = 1;
     }
-    f = fopen(argv[1], "r");
-    if (!f) {
-        perror(argv[1]);
+    if (spooldir) {
+        return serve_spool(spooldir, maxjobs, watch);
+    }
+    if (frames) {
+        return serve_frames(maxjobs);
+    }
+    if (batchdir) {
+        return serve_batch(batchdir, argv, argc, maxjobs);
+    }
+    if (io && !strcmp(io, "mem")) {
+        size_t inlen, outlen;
+        unsigned char *in = io_read_all(stdin, &inlen);
+        const unsigned char *out;
+
+        gl_io = io_memory(in, inlen);
+        rc = inet ? inet_eval() : eval_loop(g_root);
+        out = io_memory_output(gl_io, &outlen);
+        fwrite(out, 1, outlen, stdout);
+    } else {
+        gl_io = (io && !strcmp(io, "fd")) ? io_fd(0, 1) : io_stdio();
+        rc = inet ? inet_eval() : eval_loop(g_root);
+    }
+    // checkpoint_write exits, so the program ended before it got to
+    // the checkpoint; don't leave an older one there for -r to find
+    if (gl_checkpoint_file) {
+        fflush(stdout);
+        remove(gl_checkpoint_file);
+        fprintf(stderr, "%s: the program ended before the checkpoint, %s not written\n",
+                gl_name, gl_checkpoint_file);
         return 1;
     }
-#ifdef SMALL
-    gl_optimize = true;
-#endif
-    g_root = parse_whole(f);
-
-    return eval_loop(g_root);
+    return rc;
 }
 #endif
@@ -64,6 +64,10 @@ typedef enum CellType {
 #define setstack(c, x) setright(c, x)
 #define getstack(c) getright(c)
 
+/* the first cell of a run of free cells holds the end of the run */
+#define setrunend(c, x) setleft(c, x)
+#define getrunend(c) getleft(c)
+
 /* for freshly allocated cells that should not be reclaimed by gc */
 #define setpending(c) settype(c, CT_PENDING)
 #define ispending(c) (gettype(c) == CT_PENDING)
@@ -83,8 +87,39 @@ extern FullDuplexSerial ser;
 
 #include <stdio.h>
 #define putstr(x) fputs((x), stdout)
-#define getch() getchar()
-#define putch(c) putchar((c))
+
+//
+// I/O backends (io.c); getch and putch work on gl_io's buffers, and
+// its read and write callbacks move whole blocks. read returns how
+// many bytes it put in buf, 0 at the end of the input
+//
+typedef struct lazy_io LazyIO;
+typedef size_t IOReadFunc(LazyIO *io, unsigned char *buf, size_t len);
+typedef void IOWriteFunc(LazyIO *io, const unsigned char *buf, size_t len);
+struct lazy_io {
+    IOReadFunc *read;
+    IOWriteFunc *write;
+    void *data;                 // for the backend
+    unsigned char *inbuf;
+    size_t insize;
+    const unsigned char *inpos, *inend;
+    unsigned char *outbuf, *outpos, *outend;
+};
+extern LazyIO *gl_io;
+int io_fill(LazyIO *io);
+int io_drain(LazyIO *io, int c);
+void io_flush(LazyIO *io);
+void io_init(LazyIO *io, IOReadFunc *readf, IOWriteFunc *writef, void *data,
+             size_t insize, size_t outsize);
+void io_release(LazyIO *io);
+LazyIO *io_stdio(void);
+LazyIO *io_fd(int in, int out);
+LazyIO *io_memory(const void *input, size_t len);
+const unsigned char *io_memory_output(LazyIO *io, size_t *len);
+unsigned char *io_read_all(FILE *f, size_t *len);
+
+#define getch() (gl_io->inpos < gl_io->inend ? *gl_io->inpos++ : io_fill(gl_io))
+#define putch(c) (gl_io->outpos < gl_io->outend ? (*gl_io->outpos++ = (c)) : io_drain(gl_io, (c)))
 #endif
 
 #ifndef RUNTIME
@@ -110,9 +145,13 @@ void PrintTree(Cell *t);
 #define PROPELLER_BASE 8192
 #define PROPELLER_MEM_ADDR (PROPELLER_BASE + 4)
 
+// the Propeller's heap and root stack
+#define PROPELLER_NUMCELLS (5200)
+#define PROPELLER_ROOT_STACK 300
+
 #ifdef SMALL
-#define NUMCELLS (5200)
-#define ROOT_STACK_SIZE 300
+#define NUMCELLS PROPELLER_NUMCELLS
+#define ROOT_STACK_SIZE PROPELLER_ROOT_STACK
 #endif
 
 // number of cells to allocate
@@ -125,6 +164,7 @@ void PrintTree(Cell *t);
 #endif
 
 extern Cell *alloc_cell(void);
+extern void alloc_cells(Cell **cells, int n);
 extern void push_root(Cell *);
 extern Cell *pop_root();
 extern void gc(void);
@@ -138,6 +178,8 @@ void mkpair(Cell *c, Cell *X, Cell *Y, CellType t);
 
 extern void mkfunc(Cell *c, CellFunc *func, Cell *arg);
 
+extern int eval_loop();
+
 //
 // basic CellFuncs
 //
@@ -160,12 +202,203 @@ CellFunc Read_func;
 extern Cell *g_root;
 extern Cell mem[];
 Cell *parse_part(const char **str);
+Cell *parse_program(FILE *f);
+Cell *parse_text(const char *s);
+bool parse_check(const char *s);
+char *alloc_file(FILE *f);
+Cell *apply_input(Cell *prog);
 Cell *parse_whole(FILE *f);
 #endif
 
+#ifndef RUNTIME
+//
+// heap internals, for host tools that need to look inside the heap
+//
+extern Cell *free_list;
+extern Cell *heap_top;
+extern Cell **root_stack;
+extern int root_stack_top;
+// limits on the heap and root stack, normally &mem[NUMCELLS] and
+// ROOT_STACK_SIZE
+extern Cell *heap_end;
+extern int root_limit;
+
+// a frozen program is read-only, and shared by everything that runs
+// it; each graph being reduced has its own thaw map of private copies
+// of the frozen apply nodes it has reduced (gl_thaw is the current one)
+typedef struct thaw_map ThawMap;
+extern Cell *frozen_end;
+extern ThawMap *gl_thaw;
+void freeze_heap(void);
+ThawMap *new_thaw_map(void);
+void free_thaw_map(ThawMap *m);
+extern void (*gl_gc_hook)(void);
+unsigned long gc_mark_roots(Cell **roots, int count);
+void add_roots(Cell **roots, int count);
+Cell *partial_apply_primitive(Cell *A);
+
+// reduce a program as far as possible before it is applied to
+// its input (prenorm.c)
+Cell *prenorm(Cell *prog, bool verbose);
+
+// evaluator internals
+Cell *partial_eval(Cell *node);
+Cell *car(Cell *list);
+Cell *cdr(Cell *list);
+int getintvalue(Cell *X);
+CellFunc apply_S2;
+CellFunc apply_C2;
+CellFunc apply_NumPair;
+
+// statistics; gl_live is the cells found in use by the last gc,
+// gl_peak_live the most found by any, and gl_peak_roots the
+// deepest the root stack has been
+extern unsigned long gl_reductions;
+extern unsigned long gl_gcs;
+extern unsigned long gl_live;
+extern unsigned long gl_peak_live;
+extern int gl_peak_roots;
+#endif
+
+#ifdef INTERPRETER
+//
+// heap checkpoints (checkpoint.c)
+// checkpoint_write saves the heap and g_root to a file and exits;
+// checkpoint_restore maps such a file back in so that eval_loop
+// can carry on from where the checkpoint was taken. Read_func counts
+// the input it has read in gl_input_read, and first skips
+// gl_input_skip bytes: what the run had read before its checkpoint
+//
+extern const char *gl_checkpoint_file;
+extern unsigned long gl_checkpoint_at;
+extern unsigned long gl_input_read, gl_input_skip;
+void checkpoint_write(const char *fname);
+void checkpoint_restore(const char *fname);
+
+//
+// sharing equal values found by the gc (dedup.c); gl_dedup turns it
+// on, and gl_deduped counts the pointers moved to a shared copy
+//
+extern bool gl_dedup;
+extern unsigned long gl_deduped;
+void dedup_begin(void);
+Cell *dedup(Cell *c);
+
+//
+// memoizing applications (memo.c); partial_eval keeps a MemoFrame
+// for each application it is waiting to see the result of
+//
+typedef struct memo_frame {
+    int depth;              // root stack depth of the parent
+    Cell *parent, *f, *x;
+    size_t xkey;            // how memo.c knows x
+    unsigned long reductions, gcs;
+} MemoFrame;
+// the most pending applications in one partial_eval
+#define MEMO_FRAMES 32
+extern bool gl_memo;
+// the cells below this were taken up by the program when it was parsed
+extern Cell *gl_program_end;
+bool memoizable(Cell *f);
+Cell *memo_lookup(Cell *f, Cell *x);
+void memo_start(MemoFrame *F, int depth, Cell *parent, Cell *f, Cell *x);
+void memo_finish(MemoFrame *F, Cell *result);
+void memo_sweep(void);
+void memo_report(void);
+
+//
+// batch server modes (server.c); each job is run in a fork of
+// the freshly parsed heap
+//
+int serve_spool(const char *dir, int maxjobs, bool watch);
+int serve_frames(int maxjobs);
+int serve_batch(const char *outdir, char **inputs, int ninputs, int maxjobs);
+double job_clock(void);
+void note_latency(double secs, bool failed);
+void report_jobs(double elapsed);
+void write_all(const void *buf, size_t len);
+
+//
+// scheduler (sched.c); runs up to maxjobs framed jobs at a time as
+// coroutines in this process instead, each parsed from prog (or
+// running gl_shared_prog, a frozen program, if that is set) and
+// given quantum reductions at a time; maxfuel and maxcells (0 for no
+// limit) cap the reductions and live cells of each job
+//
+extern Cell *gl_shared_prog;
+extern unsigned long gl_slice_end;
+extern void (*gl_slice_hook)(void);
+extern void (*gl_fatal_hook)(const char *msg);
+int serve_sched(const char *prog, int maxjobs, unsigned long quantum,
+                unsigned long maxfuel, unsigned long maxcells);
+// the same, for connections to a Unix domain socket at path
+int serve_socket(const char *path, const char *prog, int maxjobs,
+                 unsigned long quantum, unsigned long maxfuel, unsigned long maxcells);
+
+//
+// G-machine engine (gmachine.c); compiles the supercombinators in a
+// parsed program to bytecode in place, and returns how many
+//
+int gm_compile(Cell *prog);
+
+//
+// interaction net engine (inet.c); inet_load parses a program and
+// translates it, applied to the input, to an interaction net, and
+// inet_eval reduces that as eval_loop does the graph. The net's
+// active pairs are all independent of each other: inet_active_pairs
+// puts up to max of them in pairs (two node numbers each) and returns
+// how many, and inet_reduce_pair reduces one
+//
+void inet_load(const char *text, bool optimize);
+int inet_eval(void);
+size_t inet_active_pairs(unsigned *pairs, size_t max);
+void inet_reduce_pair(unsigned a, unsigned b);
+void inet_report(void);
+
+//
+// packed strings (strings.c); pack_strings turns the constant lists
+// of bytes in a parsed program into Str_func cells, and returns how
+// many (only for the first program in a process); put_string writes
+// one out and returns the rest of its list
+//
+int pack_strings(Cell *prog);
+CellFunc Str_func;
+Cell *put_string(Cell *s);
+
+//
+// recursion (knot.c); tie_knots turns the self applications that
+// lazier compiles recursion to into cyclic graphs, and returns how
+// many
+//
+int tie_knots(Cell *prog);
+
+//
+// loading a program (lazy.c); prepare_program parses it and gets it
+// ready to run, freezing it if gl_freeze is set and packing strings
+// and tying knots if gl_host_passes is (not in lazys, or with -a),
+// and load_program also applies it to the input
+//
+extern bool gl_freeze;
+extern bool gl_host_passes;
+Cell *prepare_program(const char *text, bool optimize, bool gmachine);
+Cell *load_program(const char *text, bool optimize, bool gmachine);
+
+//
+// capacity planning (capacity.c); runs prog on the whole of stdin
+// over and over in forks with less and less memory, and reports the
+// smallest heap and root stack it needs
+//
+int plan_capacity(const char *prog, bool optimize, bool gmachine);
+#endif
+
 //
 // various options to control the parser
 //
 extern bool gl_optimize;
+#ifndef RUNTIME
+// add the optimizations listed in a file (pairs of terms, each
+// pattern followed by its replacement); returns how many
+int load_patterns(const char *fname);
+#endif
 
 #endif
@@ -0,0 +1,511 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// lazy2c: ahead of time compiler from Lazy K to C
+//
+// The parsed program is written out as straight-line C that builds
+// the graph, so there's no parsing at run time, and every closed
+// subterm that turns out to be a supercombinator (see supercomb.h)
+// becomes a C function that builds its body directly once it has all
+// its arguments. The output is linked against lazy.c, which provides
+// the allocator, gc, reduction of whatever is left and I/O.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lazy.h"
+#include "supercomb.h"
+
+static const char *gl_name = "lazy2c";
+static bool gl_verbose = false;
+
+//
+// the cells we are going to build, in the order we found them;
+// cellidx[] is 1 + the index of each cell in that list, or 0
+//
+static int *cellidx;
+static int numbuild;
+static Cell **build;
+static int maxbuild;
+
+// the supercombinator (if any) that replaces each cell
+static Supercomb **sc_of;
+static Supercomb **scs;
+static int numscs, maxscs;
+
+// constant applications made by compile time reduction; these
+// are built once and shared, just as the graph they came from was
+static STerm **consts;
+static int numconsts, maxconsts;
+
+// constants used by the compiled code; these are gc roots
+static int *kslot_of;
+static int numk;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+#define GROW(arr, num, max) \
+    if ((num) >= (max)) { \
+        (max) = (max) ? 2*(max) : 1024; \
+        (arr) = xrealloc((arr), (max) * sizeof((arr)[0])); \
+    }
+
+static int
+index_of(Cell *c)
+{
+    return c - &mem[0];
+}
+
+//
+// collect the constant parts of a body, so that we can walk
+// them after the body walk has finished
+//
+static STerm **pending;
+static int numpending, maxpending;
+
+static void
+collect_const(STerm *t, void *arg)
+{
+    GROW(pending, numpending, maxpending);
+    pending[numpending++] = t;
+}
+
+static void walk(Cell *c);
+
+static void
+walk_supercomb(Supercomb *S)
+{
+    int first = numpending;
+    int i;
+    STerm *t;
+
+    sc_walk_consts(S->body, collect_const, NULL);
+    for (i = first; i < numpending; i++) {
+        t = pending[i];
+        if (t->kind == ST_CELL) {
+            walk(t->cell);
+        } else {
+            // a constant application; it gets a build slot of its
+            // own once we know how many cells there are
+            GROW(consts, numconsts, maxconsts);
+            consts[numconsts++] = t;
+        }
+    }
+    numpending = first;
+}
+
+//
+// find everything reachable from c, and compile what we can
+//
+static void
+walk(Cell *c)
+{
+    Supercomb S;
+
+    if (!c) return;
+    if (cellidx[index_of(c)]) return;
+    GROW(build, numbuild, maxbuild);
+    build[numbuild++] = c;
+    cellidx[index_of(c)] = numbuild;
+
+    switch (gettype(c)) {
+    case CT_A_PAIR:
+        if (sc_extract(c, &S)) {
+            Supercomb *P = xrealloc(NULL, sizeof(Supercomb));
+            *P = S;
+            GROW(scs, numscs, maxscs);
+            scs[numscs++] = P;
+            sc_of[index_of(c)] = P;
+            walk_supercomb(P);
+            return;
+        }
+        /* fall through */
+    case CT_S2_PAIR:
+    case CT_C2_PAIR:
+    case CT_NUM_PAIR:
+        walk(getleft(c));
+        walk(getright(c));
+        break;
+    case CT_FUNC:
+        walk(getarg(c));
+        break;
+    default:
+        break;
+    }
+}
+
+//
+// names of the primitives we know how to emit
+//
+static struct {
+    CellFunc *fn;
+    const char *name;
+} funcnames[] = {
+    { K1_func, "K1_func" },
+    { K_func, "K_func" },
+    { KI_func, "KI_func" },
+    { S1_func, "S1_func" },
+    { S_func, "S_func" },
+    { Inc_func, "Inc_func" },
+    { C1_func, "C1_func" },
+    { C_func, "C_func" },
+    { Read_func, "Read_func" },
+};
+
+static const char *
+funcname(CellFunc *f)
+{
+    int i;
+    for (i = 0; i < sizeof(funcnames)/sizeof(funcnames[0]); i++) {
+        if (funcnames[i].fn == f) return funcnames[i].name;
+    }
+    fatal("lazy2c: unknown cell function");
+    return NULL;
+}
+
+static void
+print_cellref(FILE *f, Cell *c)
+{
+    if (c) {
+        fprintf(f, "c[%d]", cellidx[index_of(c)] - 1);
+    } else {
+        fprintf(f, "NULL");
+    }
+}
+
+// a reference to a constant from the build function
+static void
+print_constref(FILE *f, STerm *t)
+{
+    if (t->kind == ST_CELL) {
+        print_cellref(f, t->cell);
+    } else {
+        fprintf(f, "c[%d]", t->id);
+    }
+}
+
+//
+// a reference to a subterm from inside a compiled supercombinator
+//
+static void
+print_bodyref(FILE *f, STerm *t)
+{
+    int slot;
+
+    if (t->kind == ST_VAR) {
+        fprintf(f, "a[%d]", t->var);
+    } else if (t->hasvar) {
+        fprintf(f, "t%d", t->id);
+    } else {
+        // constants the code refers to live in k[]
+        slot = t->kind == ST_CELL ? cellidx[index_of(t->cell)] - 1 : t->id;
+        if (kslot_of[slot] < 0) {
+            kslot_of[slot] = numk++;
+        }
+        fprintf(f, "k[%d]", kslot_of[slot]);
+    }
+}
+
+static int numtemps;
+static STerm *bodyroot;
+
+static void
+number_temp(STerm *t, void *arg)
+{
+    if (t != bodyroot) t->id = numtemps++;
+}
+
+static void
+fill_temp(STerm *t, void *arg)
+{
+    FILE *f = arg;
+    if (t == bodyroot) return;
+    fprintf(f, "    mkapply(t%d, ", t->id);
+    print_bodyref(f, t->fun);
+    fprintf(f, ", ");
+    print_bodyref(f, t->arg);
+    fprintf(f, ");\n");
+}
+
+static void
+emit_supercomb(FILE *f, int n, Supercomb *S)
+{
+    int k, i;
+    STerm *body = S->body;
+
+    fprintf(f, "\n// arity %d, %d reductions at compile time\n", S->arity, S->steps);
+    for (k = 0; k < S->arity - 1; k++) {
+        fprintf(f, "static Cell *\nsc%d_%d(Cell *r, Cell *self, Cell *x)\n{\n", n, k);
+        if (k == 0) {
+            fprintf(f, "    mkfunc(r, sc%d_%d, x);\n", n, k+1);
+        } else {
+            fprintf(f, "    Cell *p = alloc_cell();\n");
+            fprintf(f, "    mkc2(p, getarg(self), x);\n");
+            fprintf(f, "    mkfunc(r, sc%d_%d, p);\n", n, k+1);
+        }
+        fprintf(f, "    return r;\n}\n");
+    }
+
+    fprintf(f, "static Cell *\nsc%d_%d(Cell *r, Cell *self, Cell *x)\n{\n", n, S->arity - 1);
+    fprintf(f, "    Cell *a[%d];\n", S->arity);
+    bodyroot = body;
+    numtemps = 0;
+    if (body->kind == ST_APP && body->hasvar) {
+        sc_walk_body(body, number_temp, NULL);
+    }
+    for (i = 0; i < numtemps; i++) {
+        fprintf(f, "    Cell *t%d;\n", i);
+    }
+    if (S->arity == 1) {
+        fprintf(f, "    a[0] = x;\n");
+    } else {
+        fprintf(f, "    Cell *p = getarg(self);\n");
+        fprintf(f, "    a[%d] = x;\n", S->arity - 1);
+        for (i = S->arity - 2; i > 0; --i) {
+            fprintf(f, "    a[%d] = getright(p); p = getleft(p);\n", i);
+        }
+        fprintf(f, "    a[0] = p;\n");
+    }
+    if (body->kind != ST_APP || !body->hasvar) {
+        fprintf(f, "    return ");
+        print_bodyref(f, body);
+        fprintf(f, ";\n}\n");
+        return;
+    }
+    // allocate everything before we fill any of it in, so that a
+    // gc can't take the new cells away from us
+    for (i = 0; i < numtemps; i++) {
+        fprintf(f, "    t%d = alloc_cell();\n", i);
+    }
+    sc_walk_body(body, fill_temp, f);
+    fprintf(f, "    mkapply(r, ");
+    print_bodyref(f, body->fun);
+    fprintf(f, ", ");
+    print_bodyref(f, body->arg);
+    fprintf(f, ");\n    return r;\n}\n");
+}
+
+static void
+emit_cell(FILE *f, Cell *c)
+{
+    int i = cellidx[index_of(c)] - 1;
+    Supercomb *S = sc_of[index_of(c)];
+    static const char *pairnames[] = {
+        "CT_FREE", "CT_A_PAIR", "CT_S2_PAIR", "CT_C2_PAIR", "CT_NUM_PAIR",
+    };
+
+    if (S) {
+        int n;
+        for (n = 0; scs[n] != S; n++)
+            ;
+        fprintf(f, "    mkfunc(c[%d], sc%d_0, NULL);\n", i, n);
+        return;
+    }
+    switch (gettype(c)) {
+    case CT_A_PAIR:
+    case CT_S2_PAIR:
+    case CT_C2_PAIR:
+    case CT_NUM_PAIR:
+        fprintf(f, "    mkpair(c[%d], ", i);
+        print_cellref(f, getleft(c));
+        fprintf(f, ", ");
+        print_cellref(f, getright(c));
+        fprintf(f, ", %s);\n", pairnames[gettype(c)]);
+        break;
+    case CT_NUM:
+        if (getnum(c) != 0) {
+            fprintf(f, "    mknum(c[%d], %u);\n", i, getnum(c));
+        }
+        break;
+    case CT_FUNC:
+        fprintf(f, "    mkfunc(c[%d], %s, ", i, funcname(getfunc(c)));
+        print_cellref(f, getarg(c));
+        fprintf(f, ");\n");
+        break;
+    default:
+        fatal("lazy2c: unexpected cell type");
+    }
+}
+
+static void
+emit_program(FILE *f, const char *srcname, Cell *root)
+{
+    int i, k;
+    int nb = numbuild + numconsts;
+    STerm *t;
+    FILE *code = tmpfile();
+    char buf[8192];
+    size_t n;
+
+    if (!code) {
+        perror("tmpfile");
+        exit(1);
+    }
+    kslot_of = xrealloc(NULL, nb * sizeof(int));
+    for (i = 0; i < nb; i++) kslot_of[i] = -1;
+
+    // the supercombinators go to a temporary file first, because
+    // we don't know how many constants they need until we're done
+    for (i = 0; i < numscs; i++) {
+        emit_supercomb(code, i, scs[i]);
+    }
+
+    fprintf(f, "//\n// generated by lazy2c from %s; do not edit\n//\n\n", srcname);
+    fprintf(f, "#include <string.h>\n#include \"lazy.h\"\n\n");
+    fprintf(f, "#define NBUILD %d\n#define NCONST %d\n", nb, numk ? numk : 1);
+    fprintf(f, "static Cell *c[NBUILD];\nstatic Cell *k[NCONST];\n\n");
+    for (i = 0; i < numscs; i++) {
+        for (k = 0; k < scs[i]->arity; k++) {
+            fprintf(f, "static CellFunc sc%d_%d;\n", i, k);
+        }
+    }
+    rewind(code);
+    while ((n = fread(buf, 1, sizeof(buf), code)) > 0) {
+        fwrite(buf, 1, n, f);
+    }
+    fclose(code);
+
+    fprintf(f, "\nstatic void\nbuild_graph(void)\n{\n    int i;\n\n");
+    fprintf(f, "    add_roots(c, NBUILD);\n    add_roots(k, NCONST);\n");
+    fprintf(f, "    for (i = 0; i < NBUILD; i++) {\n");
+    fprintf(f, "        c[i] = alloc_cell();\n        mknum(c[i], 0);\n    }\n");
+    for (i = 0; i < numbuild; i++) {
+        emit_cell(f, build[i]);
+    }
+    for (i = 0; i < numconsts; i++) {
+        t = consts[i];
+        fprintf(f, "    mkapply(c[%d], ", t->id);
+        print_constref(f, t->fun);
+        fprintf(f, ", ");
+        print_constref(f, t->arg);
+        fprintf(f, ");\n");
+    }
+    for (i = 0; i < nb; i++) {
+        if (kslot_of[i] >= 0) {
+            // compiled code keeps using these, so they must never
+            // be reclaimed early
+            fprintf(f, "    k[%d] = c[%d];\n", kslot_of[i], i);
+            fprintf(f, "    setshared(c[%d]);\n", i);
+        }
+    }
+    fprintf(f, "    g_root = ");
+    print_cellref(f, root);
+    fprintf(f, ";\n    // the rest of the graph can be collected as usual\n");
+    fprintf(f, "    memset(c, 0, sizeof(c));\n}\n\n");
+    fprintf(f, "int\nmain(int argc, char **argv)\n{\n");
+    fprintf(f, "    build_graph();\n");
+    fprintf(f, "    g_root = apply_input(g_root);\n");
+    fprintf(f, "    return eval_loop(g_root);\n}\n");
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "Usage: %s [-v][-O][-o out.c] file.lazy\n", gl_name);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *f;
+    const char *infile;
+    char *outfile = NULL;
+    char *ext;
+    int i, size;
+
+    gl_name = argv[0];
+    argv++; --argc;
+    while (argv[0] && argv[0][0] == '-') {
+        switch (argv[0][1]) {
+        case 'v': gl_verbose = true; break;
+        case 'O': gl_optimize = true; break;
+        case 'o':
+            if (!argv[1]) Usage();
+            outfile = argv[1];
+            argv++; --argc;
+            break;
+        default:
+            Usage();
+        }
+        argv++; --argc;
+    }
+    if (argc != 1) Usage();
+    infile = argv[0];
+    f = fopen(infile, "r");
+    if (!f) {
+        perror(infile);
+        return 1;
+    }
+    g_root = parse_program(f);
+    fclose(f);
+
+    cellidx = calloc(NUMCELLS, sizeof(int));
+    sc_of = calloc(NUMCELLS, sizeof(Supercomb *));
+    if (!cellidx || !sc_of) fatal("out of memory");
+    walk(g_root);
+    for (i = 0; i < numconsts; i++) {
+        consts[i]->id = numbuild + i;
+    }
+
+    if (!outfile) {
+        outfile = xrealloc(NULL, strlen(infile) + 8);
+        strcpy(outfile, infile);
+        ext = strrchr(outfile, '.');
+        if (ext) {
+            strcpy(ext, ".c");
+        } else {
+            strcat(outfile, ".c");
+        }
+    }
+    f = fopen(outfile, "w");
+    if (!f) {
+        perror(outfile);
+        return 1;
+    }
+    emit_program(f, infile, g_root);
+    if (fclose(f) != 0) {
+        perror(outfile);
+        return 1;
+    }
+    if (gl_verbose) {
+        size = 0;
+        for (i = 0; i < numscs; i++) size += scs[i]->size;
+        fprintf(stderr, "%s: %d cells, %d supercombinators (%d body cells), %d constants\n",
+                outfile, numbuild, numscs, size, numk);
+    }
+    return 0;
+}
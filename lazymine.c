@@ -0,0 +1,641 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// lazymine: find the subterms worth adding to the optimizer's table
+//
+// Every program in the corpus is parsed (without the optimizer) and
+// each of its subterms is given a number, with equal terms getting
+// equal numbers, so we can count how often each one turns up and
+// how big it is. Every subterm of a Lazy K program is closed, so any
+// of them could be replaced by something else that behaves the same.
+//
+// The most promising ones are then run in the interpreter, each trial
+// in a fork() of its own so that a term that loops, or runs Inc on
+// something that isn't a number, costs us nothing:
+//
+//  - a term that, given a successor and a zero that it can't look
+//    inside, applies the successor n times to the zero is the
+//    numeral n; replacing it with [n] saves its cells and the
+//    reductions it took to get there
+//  - otherwise we apply the term to 1, 2, ... fresh variables until
+//    one of them ends up at the head; the arity and the reductions
+//    that took tell us what a native primitive for it would save on
+//    every call
+//
+// The numerals are written out as a table that `lazy -p` and
+// `proplazy -p` can load, and the primitive candidates follow as
+// comments.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lazy.h"
+
+static const char *gl_name = "lazymine";
+
+// defaults, see Usage()
+static unsigned long min_count = 2;
+static unsigned long min_size = 4;
+static int max_trials = 200;
+static unsigned long fuel = 100000;
+
+// how many variables we will try a term on
+#define MAX_ARITY 4
+
+//
+// a term is either a leaf (left < 0, and right is the index of its
+// text in leaves[]) or the application of term left to term right
+//
+typedef struct Term {
+    int left, right;
+    unsigned long count;    // times it occurs in the corpus
+    unsigned long size;     // application cells it takes
+    int parent;             // the term every occurrence is inside of,
+                            // NO_PARENT or MANY_PARENTS
+    // filled in by the trials
+    int kind;
+    long value;             // the numeral, or the arity
+    unsigned long reductions;
+} Term;
+
+#define NO_PARENT (-1)
+#define MANY_PARENTS (-2)
+
+enum { T_UNTRIED, T_OTHER, T_NUMERAL, T_PRIMITIVE };
+
+static Term *terms;
+static int numterms, maxterms;
+
+static char **leaves;
+static int numleaves, maxleaves;
+
+// open hash from (left, right) to term number + 1
+static int *hash;
+static unsigned long hashsize;
+
+static unsigned long numprograms, numcells;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+#define GROW(arr, num, max) \
+    if ((num) >= (max)) { \
+        (max) = (max) ? 2*(max) : 1024; \
+        (arr) = xrealloc((arr), (max) * sizeof((arr)[0])); \
+    }
+
+static unsigned long
+hash_pair(int left, int right)
+{
+    unsigned long h = (unsigned)left * 2654435761UL;
+    h ^= (unsigned)right + 0x9e3779b9UL + (h << 6) + (h >> 2);
+    return h;
+}
+
+static void
+rehash(void)
+{
+    unsigned long i, h;
+    int n;
+
+    free(hash);
+    hashsize = hashsize ? 2*hashsize : 4096;
+    hash = calloc(hashsize, sizeof(int));
+    if (!hash) fatal("out of memory");
+    for (n = 0; n < numterms; n++) {
+        h = hash_pair(terms[n].left, terms[n].right);
+        for (i = h & (hashsize-1); hash[i]; i = (i+1) & (hashsize-1))
+            ;
+        hash[i] = n+1;
+    }
+}
+
+// find the term (left right), adding it if it is new
+static int
+intern(int left, int right, unsigned long size)
+{
+    unsigned long i;
+    Term *t;
+    int n;
+
+    if (2*(unsigned long)numterms >= hashsize) rehash();
+    i = hash_pair(left, right) & (hashsize-1);
+    for (; (n = hash[i]) != 0; i = (i+1) & (hashsize-1)) {
+        t = &terms[n-1];
+        if (t->left == left && t->right == right) return n-1;
+    }
+    GROW(terms, numterms, maxterms);
+    t = &terms[numterms];
+    memset(t, 0, sizeof(*t));
+    t->left = left;
+    t->right = right;
+    t->size = size;
+    t->parent = NO_PARENT;
+    hash[i] = numterms+1;
+    return numterms++;
+}
+
+static int
+intern_leaf(const char *text)
+{
+    int i;
+
+    for (i = 0; i < numleaves; i++) {
+        if (!strcmp(leaves[i], text)) break;
+    }
+    if (i == numleaves) {
+        GROW(leaves, numleaves, maxleaves);
+        leaves[numleaves++] = strdup(text);
+    }
+    return intern(-1, i, 0);
+}
+
+static int
+leaf_of(Cell *c)
+{
+    char buf[32];
+    CellFunc *f;
+
+    if (gettype(c) == CT_NUM) {
+        if (getnum(c) == 1) return intern_leaf("i");
+        sprintf(buf, "[%d]", getnum(c));
+        return intern_leaf(buf);
+    }
+    if (gettype(c) != CT_FUNC) fatal("unexpected cell in parsed program");
+    f = getfunc(c);
+    if (f == K_func) return intern_leaf("k");
+    if (f == S_func) return intern_leaf("s");
+    if (f == C_func) return intern_leaf("c");
+    if (f == Inc_func) return intern_leaf("+");
+    fatal("unexpected function in parsed program");
+    return -1;
+}
+
+static void
+note_parent(int n, int parent)
+{
+    Term *t = &terms[n];
+
+    if (t->parent == NO_PARENT) {
+        t->parent = parent;
+    } else if (t->parent != parent) {
+        t->parent = MANY_PARENTS;
+    }
+}
+
+//
+// count every subterm of the tree c; returns its term number
+//
+static int
+count_terms(Cell *c)
+{
+    int l, r, n;
+
+    if (gettype(c) != CT_A_PAIR) {
+        n = leaf_of(c);
+    } else {
+        l = count_terms(getleft(c));
+        r = count_terms(getright(c));
+        n = intern(l, r, 1 + terms[l].size + terms[r].size);
+        note_parent(l, n);
+        note_parent(r, n);
+        numcells++;
+    }
+    terms[n].count++;
+    return n;
+}
+
+static void
+print_term(FILE *f, int n)
+{
+    while (terms[n].left >= 0) {
+        putc('`', f);
+        print_term(f, terms[n].left);
+        n = terms[n].right;
+    }
+    fputs(leaves[terms[n].right], f);
+}
+
+//
+// trials; everything from here to run_trial() happens in a child
+//
+
+static Cell *vars[MAX_ARITY];
+static int arity;
+
+static void
+out_of_fuel(void)
+{
+    _exit(3);
+}
+
+static void
+discard(LazyIO *io, const unsigned char *buf, size_t len)
+{
+}
+
+static int trial_pipe;
+
+static void
+report(int kind, long value)
+{
+    Term t;
+
+    t.kind = kind;
+    t.value = value;
+    t.reductions = gl_reductions;
+    if (write(trial_pipe, &t, sizeof(t)) != sizeof(t)) _exit(4);
+    _exit(0);
+}
+
+// a variable has ended up at the head
+static Cell *
+Var_func(Cell *r, Cell *self, Cell *rhs)
+{
+    report(T_PRIMITIVE, arity);
+    return r;
+}
+
+static Cell *
+num_cell(int n)
+{
+    Cell *c = alloc_cell();
+
+    mknum(c, n);
+    return c;
+}
+
+static Cell *
+func_cell(CellFunc *f)
+{
+    Cell *c = alloc_cell();
+
+    mkfunc(c, f, NULL);
+    return c;
+}
+
+static Cell *
+build_term(int n)
+{
+    Cell *c, *l, *r;
+    const char *s;
+
+    if (terms[n].left < 0) {
+        s = leaves[terms[n].right];
+        switch (*s) {
+        case 'i': return num_cell(1);
+        case '[': return num_cell(atoi(s+1));
+        case 'k': return func_cell(K_func);
+        case 's': return func_cell(S_func);
+        case 'c': return func_cell(C_func);
+        default:  return func_cell(Inc_func);
+        }
+    }
+    l = build_term(terms[n].left);
+    push_root(l);
+    r = build_term(terms[n].right);
+    push_root(r);
+    c = alloc_cell();
+    pop_root(); pop_root();
+    mkapply(c, l, r);
+    return c;
+}
+
+static Cell *
+apply_to(Cell *f, Cell *x)
+{
+    Cell *c;
+
+    push_root(f);
+    push_root(x);
+    c = alloc_cell();
+    pop_root(); pop_root();
+    mkapply(c, f, x);
+    return c;
+}
+
+// reduce c to weak head normal form
+static Cell *
+force(Cell *c)
+{
+    while (gettype(c) == CT_A_PAIR) {
+        push_root(c);
+        c = partial_eval(c);
+        pop_root();
+    }
+    return c;
+}
+
+//
+// the numeral trial uses its own zero and successor, which nothing
+// but the successor can look inside (the runtime's own numbers are
+// functions too, so a term could get a number out of them some
+// other way)
+//
+static Cell *
+Opaque_func(Cell *r, Cell *self, Cell *rhs)
+{
+    _exit(1);
+    return r;
+}
+
+static Cell *
+Succ_func(Cell *r, Cell *self, Cell *rhs)
+{
+    int n = 0;
+
+    rhs = force(rhs);
+    if (gettype(rhs) != CT_FUNC || getfunc(rhs) != Opaque_func) _exit(1);
+    if (getarg(rhs)) n = getnum(getarg(rhs));
+    push_root(rhs);
+    mkfunc(r, Opaque_func, num_cell(n+1));
+    pop_root();
+    return r;
+}
+
+static void
+numeral_trial(int n)
+{
+    Cell *c;
+
+    c = build_term(n);
+    push_root(c);
+    c = apply_to(c, func_cell(Succ_func));
+    pop_root();
+    push_root(c);
+    c = apply_to(c, func_cell(Opaque_func));
+    pop_root();
+    c = force(c);
+    if (gettype(c) != CT_FUNC || getfunc(c) != Opaque_func) _exit(1);
+    report(T_NUMERAL, getarg(c) ? getnum(getarg(c)) : 0);
+}
+
+static void
+primitive_trial(int n)
+{
+    Cell *c;
+    int i, k;
+
+    for (k = 1; k <= MAX_ARITY; k++) {
+        arity = k;
+        gl_reductions = 0;
+        gl_slice_end = fuel;
+        c = build_term(n);
+        for (i = 0; i < k; i++) {
+            c = apply_to(c, vars[i]);
+        }
+        c = force(c);
+        if (gettype(c) == CT_FUNC && getfunc(c) == Var_func) {
+            report(T_PRIMITIVE, arity);
+        }
+    }
+    _exit(1);
+}
+
+//
+// run one kind of trial on term n in a child, and record what it
+// found; returns true if it found anything
+//
+static bool
+run_trial(int n, void (*trial)(int))
+{
+    int fds[2];
+    pid_t pid;
+    Term result;
+    int status, i;
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(2);
+    }
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(2);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        trial_pipe = fds[1];
+        gl_io->write = discard;
+        gl_slice_hook = out_of_fuel;
+        gl_slice_end = fuel;
+        gl_reductions = 0;
+        for (i = 0; i < MAX_ARITY; i++) {
+            vars[i] = func_cell(Var_func);
+            push_root(vars[i]);
+        }
+        (*trial)(n);
+        _exit(1);
+    }
+    close(fds[1]);
+    i = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (i != sizeof(result)) return false;
+    terms[n].kind = result.kind;
+    terms[n].value = result.value;
+    terms[n].reductions = result.reductions;
+    return true;
+}
+
+//
+// ranking
+//
+
+// cells saved by replacing every occurrence with one native cell
+static unsigned long
+static_score(const Term *t)
+{
+    return t->count * (t->size - 1);
+}
+
+// what the trials say we would save
+static unsigned long
+score(const Term *t)
+{
+    if (t->kind == T_PRIMITIVE) return t->count * t->reductions;
+    return t->count * (t->size - 1 + t->reductions);
+}
+
+static int
+by_static_score(const void *a, const void *b)
+{
+    unsigned long x = static_score(&terms[*(const int *)a]);
+    unsigned long y = static_score(&terms[*(const int *)b]);
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int
+by_score(const void *a, const void *b)
+{
+    unsigned long x = score(&terms[*(const int *)a]);
+    unsigned long y = score(&terms[*(const int *)b]);
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// is every occurrence of t inside one bigger term of the same kind
+// that we are reporting anyway?
+static bool
+covered(const Term *t)
+{
+    return t->parent >= 0 && terms[t->parent].kind == t->kind;
+}
+
+static void
+write_table(FILE *f, int *cand, int numcand)
+{
+    int i;
+    Term *t;
+
+    fprintf(f, "# made by %s from %lu programs: %lu application cells, "
+            "%d distinct subterms\n", gl_name, numprograms, numcells,
+            numterms);
+    fprintf(f, "#\n# numerals: pattern [n] # count x cells, reductions\n");
+    for (i = 0; i < numcand; i++) {
+        t = &terms[cand[i]];
+        if (t->kind != T_NUMERAL || covered(t)) continue;
+        print_term(f, cand[i]);
+        fprintf(f, " [%ld] # %lu x %lu, %lu\n", t->value,
+                t->count, t->size, t->reductions);
+    }
+    fprintf(f, "#\n# candidates for native primitives:\n"
+            "# count x cells, arity, reductions per call: term\n");
+    for (i = 0; i < numcand; i++) {
+        t = &terms[cand[i]];
+        if (t->kind != T_PRIMITIVE || covered(t)) continue;
+        fprintf(f, "# %lu x %lu, %ld, %lu: ", t->count, t->size,
+                t->value, t->reductions);
+        print_term(f, cand[i]);
+        putc('\n', f);
+    }
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "Usage: %s [-c mincount][-s minsize][-n trials][-f fuel][-o table] file.lazy...\n", gl_name);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *f;
+    char *outfile = NULL;
+    char *text;
+    int *cand;
+    int i, numcand, numfound;
+    Cell *prog;
+
+    gl_name = argv[0];
+    argv++; --argc;
+    while (argv[0] && argv[0][0] == '-') {
+        if (!argv[1]) Usage();
+        switch (argv[0][1]) {
+        case 'c': min_count = strtoul(argv[1], NULL, 0); break;
+        case 's': min_size = strtoul(argv[1], NULL, 0); break;
+        case 'n': max_trials = atoi(argv[1]); break;
+        case 'f': fuel = strtoul(argv[1], NULL, 0); break;
+        case 'o': outfile = argv[1]; break;
+        default:
+            Usage();
+        }
+        argv += 2; argc -= 2;
+    }
+    if (argc < 1 || min_size < 2 || fuel == 0) Usage();
+
+    for (; argc > 0; argv++, --argc) {
+        f = fopen(argv[0], "r");
+        if (!f) {
+            perror(argv[0]);
+            return 1;
+        }
+        text = alloc_file(f);
+        fclose(f);
+        if (!parse_check(text)) {
+            fprintf(stderr, "%s: not in combinator syntax, skipped\n", argv[0]);
+            free(text);
+            continue;
+        }
+        prog = parse_text(text);
+        free(text);
+        count_terms(prog);
+        numprograms++;
+    }
+
+    // the candidates, best first
+    cand = xrealloc(NULL, (numterms + 1) * sizeof(int));
+    numcand = 0;
+    for (i = 0; i < numterms; i++) {
+        if (terms[i].count >= min_count && terms[i].size >= min_size) {
+            cand[numcand++] = i;
+        }
+    }
+    qsort(cand, numcand, sizeof(int), by_static_score);
+    if (numcand > max_trials) numcand = max_trials;
+
+    numfound = 0;
+    for (i = 0; i < numcand; i++) {
+        if (run_trial(cand[i], numeral_trial)
+            || run_trial(cand[i], primitive_trial)) {
+            numfound++;
+        } else {
+            terms[cand[i]].kind = T_OTHER;
+        }
+    }
+    qsort(cand, numcand, sizeof(int), by_score);
+
+    f = stdout;
+    if (outfile) {
+        f = fopen(outfile, "w");
+        if (!f) {
+            perror(outfile);
+            return 1;
+        }
+    }
+    write_table(f, cand, numcand);
+    if (f != stdout && fclose(f) != 0) {
+        perror(outfile);
+        return 1;
+    }
+    fprintf(stderr, "%lu programs, %d distinct subterms, %d tried, %d useful\n",
+            numprograms, numterms, numcand, numfound);
+    return 0;
+}
@@ -24,9 +24,15 @@ struct func {
     Cell     *arg;
 };
 
+//
+// refs counts the pointers to the cell held in other cells, up to 2
+// (meaning "shared"); pointers from the C stack, root stack and
+// globals aren't counted
+//
 struct cell {
     CellType type;
-    unsigned int used;
+    unsigned int used:1;
+    unsigned int refs:2;
     union {
         Pair p;
         Func f;
@@ -50,4 +56,10 @@ static inline void setarg(Cell *c, Cell *arg) { c->u.f.arg = arg; }
 static inline void setnum(Cell *c, unsigned num) { c->u.n = num; }
 static inline void setused(Cell *c, bool yes) { c->used = yes ? 1 : 0; }
 
+static inline void clearrefs(Cell *c) { c->refs = 0; }
+static inline void addref(Cell *c) { if (c->refs < 2) c->refs++; }
+// (a frozen cell is already shared, and mustn't be written to)
+static inline void setshared(Cell *c) { if (c->refs != 2) c->refs = 2; }
+static inline bool isunique(Cell *c) { return c->refs == 1; }
+
 #endif
@@ -0,0 +1,210 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// memoizing applications (lazy -M)
+//
+// Every Lazy K term is closed and pure, so applying one function cell
+// to one argument cell always gives the same result, and programs do
+// that a lot: a predicate applied to the same numeral, an interpreter
+// decoding the same instruction. With -M, partial_eval looks up each
+// application of a shared function in a table of results, keyed by
+// the two cells, before reducing it; if it isn't there, it notes
+// where the application is, and when that has been reduced to weak
+// head normal form (taking at least MEMO_MIN_REDUCTIONS reductions
+// to get there) the result is entered.
+//
+// The table is direct mapped, so a new entry just replaces whatever
+// was in its slot, and it holds its cells weakly: at each gc an entry
+// goes if any of its cells isn't otherwise in use, since the cell may
+// then be reused for something else. A pending application is
+// forgotten if there is a gc before it finishes, for the same reason.
+// The cells of an entry are all marked shared, so that the eager
+// reclamation in partial_eval leaves them alone.
+//
+// Input is the one thing that isn't pure, so applications of Read
+// are never memoized.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "lazy.h"
+
+// entries in the table (a power of 2)
+#define MEMO_SIZE 65536
+// the least work worth remembering
+#define MEMO_MIN_REDUCTIONS 16
+
+typedef struct memo_entry {
+    Cell *f;
+    uintptr_t x;            // see key()
+    Cell *result;
+} MemoEntry;
+
+bool gl_memo;
+Cell *gl_program_end = &mem[0];
+
+static MemoEntry *table;
+static unsigned long lookups, hits, stores, replaced, dropped, abandoned;
+
+//
+// a number argument is known by its value, since every character read
+// and every count is a new cell; anything else by its cell (cells
+// are aligned, so the two can't be confused)
+//
+static uintptr_t
+key(Cell *x)
+{
+    if (gettype(x) == CT_NUM) {
+        return ((uintptr_t)getnum(x) << 1) | 1;
+    }
+    return (uintptr_t)x;
+}
+
+static MemoEntry *
+slot(Cell *f, uintptr_t x)
+{
+    uintptr_t h = (uintptr_t)f * 0x9e3779b97f4a7c15ULL ^ x;
+
+    if (!table) {
+        table = calloc(MEMO_SIZE, sizeof(MemoEntry));
+        if (!table) fatal("out of memory");
+    }
+    h ^= h >> 32;
+    return &table[(h ^ (h >> 16)) & (MEMO_SIZE-1)];
+}
+
+//
+// can the application of f be memoized? Only the program's own
+// functions are worth it: anything made while it runs is a partial
+// application with its own new cell, and is hardly ever applied to
+// the same thing twice. If f is unique this is the only application
+// of it there will ever be anyway.
+//
+bool
+memoizable(Cell *f)
+{
+    return f < gl_program_end && !isunique(f)
+        && !(gettype(f) == CT_FUNC && getfunc(f) == Read_func);
+}
+
+//
+// the remembered result of applying f to x, or NULL
+//
+Cell *
+memo_lookup(Cell *f, Cell *x)
+{
+    uintptr_t k = key(x);
+    MemoEntry *E = slot(f, k);
+
+    lookups++;
+    if (E->f == f && E->x == k) {
+        hits++;
+        return E->result;
+    }
+    return NULL;
+}
+
+//
+// the application of f to x, whose parent in the spine is parent at
+// root stack depth depth, is about to be reduced
+//
+void
+memo_start(MemoFrame *F, int depth, Cell *parent, Cell *f, Cell *x)
+{
+    F->depth = depth;
+    F->parent = parent;
+    F->f = f;
+    F->x = x;
+    F->xkey = key(x);
+    F->reductions = gl_reductions;
+    F->gcs = gl_gcs;
+    setshared(f);
+    setshared(x);
+}
+
+//
+// and this is what it came to
+//
+void
+memo_finish(MemoFrame *F, Cell *result)
+{
+    MemoEntry *E;
+
+    if (F->gcs != gl_gcs) {
+        abandoned++;
+        return;
+    }
+    if (gl_reductions - F->reductions < MEMO_MIN_REDUCTIONS) {
+        return;
+    }
+    E = slot(F->f, F->xkey);
+    if (E->f) {
+        replaced++;
+    }
+    E->f = F->f;
+    E->x = F->xkey;
+    E->result = result;
+    setshared(result);
+    stores++;
+}
+
+static bool
+alive(Cell *c)
+{
+    return c < frozen_end || getused(c);
+}
+
+//
+// called by the gc once everything in use is marked
+//
+void
+memo_sweep(void)
+{
+    MemoEntry *E;
+
+    if (!table) return;
+    for (E = table; E < table + MEMO_SIZE; E++) {
+        if (E->f && !(alive(E->f) && ((E->x & 1) || alive((Cell *)E->x))
+                      && alive(E->result))) {
+            E->f = E->result = NULL;
+            E->x = 0;
+            dropped++;
+        }
+    }
+}
+
+void
+memo_report(void)
+{
+    fprintf(stderr, "memo: %lu lookups, %lu hits (%.1f%%), %lu stored, "
+            "%lu replaced, %lu dropped by gc, %lu abandoned\n",
+            lookups, hits, lookups ? 100.0 * hits / lookups : 0.0,
+            stores, replaced, dropped, abandoned);
+}
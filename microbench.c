@@ -0,0 +1,420 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// microbench: time the evaluator's primitives one at a time
+//
+// Timing whole programs mixes up parsing, reduction, gc and I/O, so
+// here each primitive is run on its own, on a graph built for it:
+//
+//  - alloc_cell, handing out cells from a freshly collected heap
+//  - gc, for several heap sizes and sizes of live set (a list)
+//  - the reduction rules, each called directly on a batch of apply
+//    nodes made ready beforehand, so only the rule itself is timed
+//  - parse_whole, on the text of each program named on the command
+//    line, read from memory
+//
+// Every measurement is repeated (after one run to warm up) and we
+// report the median, the interquartile range as a percentage of the
+// median, and the fastest and slowest runs.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lazy.h"
+
+static const char *gl_name = "microbench";
+
+// defaults, see Usage()
+static int reps = 11;
+static unsigned long ops = 100000;
+static const char *only;
+
+// the most cells a single operation allocates, with its apply node
+#define MAX_CELLS_PER_OP 4
+
+static double
+clock_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+//
+// throw away everything in the heap
+//
+static void
+reset_heap(void)
+{
+    g_root = NULL;
+    root_stack_top = 0;
+    gc();
+}
+
+//
+// make the heap the first cells cells of mem; after reset_heap
+// nothing above that is in use, and cells never handed out are
+// already free
+//
+static void
+set_heap_size(unsigned long cells)
+{
+    reset_heap();
+    heap_top = heap_end = &mem[cells];
+    gc();
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double
+percentile(double *t, int n, double p)
+{
+    return t[(int)(p * (n-1) + 0.5)];
+}
+
+//
+// run bench reps times, each doing n of something, and print the
+// time per thing; returns the median
+//
+typedef double BenchFunc(void *arg);
+
+static double
+measure(const char *name, BenchFunc *bench, void *arg, double n, const char *unit)
+{
+    double *t = xrealloc(NULL, reps * sizeof(double));
+    double med;
+    int i;
+
+    (*bench)(arg);
+    for (i = 0; i < reps; i++) {
+        t[i] = (*bench)(arg) / n * 1e9;
+    }
+    qsort(t, reps, sizeof(double), cmp_double);
+    med = percentile(t, reps, 0.5);
+    printf("%-32s %10.2f %-8s +-%5.1f%%  (min %.2f, max %.2f)\n",
+           name, med, unit,
+           med > 0 ? 50.0 * (percentile(t, reps, 0.75) - percentile(t, reps, 0.25)) / med : 0.0,
+           t[0], t[reps-1]);
+    free(t);
+    return med;
+}
+
+static bool
+wanted(const char *name)
+{
+    return !only || !strncmp(name, only, strlen(only));
+}
+
+//
+// alloc_cell; each cell is made a number, since the gc won't free
+// more than a few pending cells
+//
+static double
+bench_alloc(void *arg)
+{
+    unsigned long i;
+    double start;
+
+    reset_heap();
+    start = clock_now();
+    for (i = 0; i < ops; i++) {
+        mknum(alloc_cell(), 1);
+    }
+    return clock_now() - start;
+}
+
+//
+// gc with a list of live cells hanging off g_root
+//
+typedef struct GcCase {
+    unsigned long heap;
+    unsigned long live;
+} GcCase;
+
+static void
+build_list(unsigned long n)
+{
+    Cell *one = alloc_cell();
+    Cell *c;
+
+    mknum(one, 1);
+    g_root = one;
+    while (n-- > 1) {
+        c = alloc_cell();
+        mkc2(c, one, g_root);
+        g_root = c;
+    }
+}
+
+static double
+bench_gc(void *arg)
+{
+    double start = clock_now();
+
+    gc();
+    return clock_now() - start;
+}
+
+static void
+run_gc(void)
+{
+    static const double heaps[] = { 0.125, 0.5, 1.0 };
+    static const double lives[] = { 0.0, 0.1, 0.5, 0.9 };
+    char name[64];
+    GcCase G;
+    int h, l;
+
+    for (h = 0; h < 3; h++) {
+        for (l = 0; l < 4; l++) {
+            G.heap = (unsigned long)(heaps[h] * NUMCELLS);
+            G.live = (unsigned long)(lives[l] * G.heap);
+            set_heap_size(G.heap);
+            if (G.live > 0) {
+                build_list(G.live);
+            }
+            snprintf(name, sizeof(name), "gc heap %lu live %lu", G.heap, G.live);
+            measure(name, bench_gc, &G, 1e3, "us/gc");
+        }
+    }
+    set_heap_size(NUMCELLS);
+}
+
+//
+// the reduction rules; build makes an apply node whose left hand
+// side the rule applies to
+//
+typedef struct Rule {
+    const char *name;
+    CellFunc *func;
+    Cell *(*build)(void);
+} Rule;
+
+// shared operands for the apply nodes
+static Cell *cK, *x, *y, *two;
+
+static Cell *
+apply_to(Cell *lhs, Cell *rhs)
+{
+    Cell *A = alloc_cell();
+    mkapply(A, lhs, rhs);
+    return A;
+}
+
+// (K x)
+static Cell *
+build_K(void)
+{
+    return apply_to(cK, x);
+}
+
+// ((S1 x) y)
+static Cell *
+build_S1(void)
+{
+    Cell *s1 = alloc_cell();
+    mkfunc(s1, S1_func, x);
+    return apply_to(s1, y);
+}
+
+// ((S2 x y) x)
+static Cell *
+build_S2(void)
+{
+    Cell *s2 = alloc_cell();
+    mks2(s2, x, y);
+    return apply_to(s2, x);
+}
+
+// ((C2 x y) 2), which can't just pick x or y
+static Cell *
+build_C2(void)
+{
+    Cell *c2 = alloc_cell();
+    mkc2(c2, x, y);
+    return apply_to(c2, two);
+}
+
+// ((5 K) x)
+static Cell *
+build_NumPair(void)
+{
+    Cell *n = alloc_cell();
+    Cell *np = alloc_cell();
+    mknum(n, 5);
+    mknumpair(np, n, cK);
+    return apply_to(np, x);
+}
+
+static const Rule rules[] = {
+    { "apply_S2", apply_S2, build_S2 },
+    { "apply_C2", apply_C2, build_C2 },
+    { "apply_NumPair", apply_NumPair, build_NumPair },
+    { "K_func", K_func, build_K },
+    { "S1_func", S1_func, build_S1 },
+};
+
+static double
+bench_rule(void *arg)
+{
+    const Rule *R = arg;
+    Cell **nodes = xrealloc(NULL, ops * sizeof(Cell *));
+    Cell *A;
+    unsigned long i;
+    double start, end;
+
+    reset_heap();
+    cK = alloc_cell();
+    mkfunc(cK, K_func, NULL);
+    x = alloc_cell();
+    mknum(x, 1);
+    y = alloc_cell();
+    mknum(y, 1);
+    two = alloc_cell();
+    mknum(two, 2);
+    for (i = 0; i < ops; i++) {
+        nodes[i] = (*R->build)();
+    }
+    start = clock_now();
+    for (i = 0; i < ops; i++) {
+        A = nodes[i];
+        (*R->func)(A, getleft(A), getright(A));
+    }
+    end = clock_now();
+    free(nodes);
+    return end - start;
+}
+
+//
+// parse_whole, on a program held in memory
+//
+typedef struct Text {
+    char *text;
+    size_t len;
+} Text;
+
+static double
+bench_parse(void *arg)
+{
+    Text *T = arg;
+    FILE *f;
+    double start, end;
+
+    reset_heap();
+    f = fmemopen(T->text, T->len, "r");
+    if (!f) fatal("fmemopen failed");
+    start = clock_now();
+    parse_whole(f);
+    end = clock_now();
+    fclose(f);
+    return end - start;
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "Usage: %s [-r reps][-n ops][-b bench] [file.lazy...]\n", gl_name);
+    fprintf(stderr, "  -r reps:  times to repeat each measurement (default 11)\n");
+    fprintf(stderr, "  -n ops:   operations per repetition (default 100000)\n");
+    fprintf(stderr, "  -b bench: only run the benchmarks whose names start with bench\n");
+    fprintf(stderr, "  the programs given are used to time parse_whole\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *f;
+    Text T;
+    char name[64];
+    const char *base;
+    double med;
+    int i;
+
+    gl_name = argv[0];
+    argv++; --argc;
+    while (argv[0] && argv[0][0] == '-') {
+        if (!argv[1]) Usage();
+        switch (argv[0][1]) {
+        case 'r': reps = atoi(argv[1]); break;
+        case 'n': ops = strtoul(argv[1], NULL, 0); break;
+        case 'b': only = argv[1]; break;
+        default:
+            Usage();
+        }
+        argv += 2; argc -= 2;
+    }
+    // the batch for a rule has to fit without a gc
+    if (reps < 1 || ops == 0 || ops > NUMCELLS / (2*MAX_CELLS_PER_OP)) Usage();
+
+    if (wanted("alloc_cell")) {
+        measure("alloc_cell", bench_alloc, NULL, ops, "ns/cell");
+    }
+    if (wanted("gc")) {
+        run_gc();
+    }
+    for (i = 0; i < (int)(sizeof(rules)/sizeof(rules[0])); i++) {
+        if (wanted(rules[i].name)) {
+            measure(rules[i].name, bench_rule, (void *)&rules[i], ops, "ns/op");
+        }
+    }
+    for (; argc > 0; argv++, --argc) {
+        base = strrchr(argv[0], '/');
+        base = base ? base + 1 : argv[0];
+        snprintf(name, sizeof(name), "parse_whole %s", base);
+        if (!wanted(name)) continue;
+        f = fopen(argv[0], "r");
+        if (!f) {
+            perror(argv[0]);
+            return 1;
+        }
+        T.text = alloc_file(f);
+        T.len = strlen(T.text);
+        fclose(f);
+        med = measure(name, bench_parse, &T, T.len, "ns/byte");
+        printf("%-32s %10.2f MB/s\n", "", 1e3 / med);
+        free(T.text);
+    }
+    return 0;
+}
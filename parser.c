@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 
 #include "lazy.h"
@@ -110,28 +111,6 @@ getNextChar(const char **s_ptr)
     return tolower(c);
 }
 
-//
-// try to match string "def", skipping non-essential characters like whitespace
-// returns 1 if the strings matched, 0 if not
-// if a match happened, updates s_ptr to point after the match
-// otherwise leaves s_ptr alone
-// This is used by the optimizer to find substrings to replace.
-//
-static int
-match_part(const char **s_ptr, const char *def)
-{
-    const char *s = *s_ptr;
-    int c = 1;
-
-    while (*def != 0) {
-        c = getNextChar(&s);
-        if (c != *def) return 0;
-        def++;
-    }
-    *s_ptr = s;
-    return 1;
-}
-
 //
 // table of optimizations
 // if the input tree matches the string "orig", then actually parse
@@ -153,6 +132,198 @@ struct optimize {
 
 #define OPTTAB_SIZE (sizeof(opttab)/sizeof(opttab[0]))
 
+//
+// the optimizations are kept in a trie over the characters
+// getNextChar returns, so all of them are checked in one scan
+// of the input no matter how many there are. Node 0 is the root;
+// a node's children are chained through "sibling".
+// Every pattern is a complete term, and no term is a prefix of
+// another, so the first pattern end we reach is the only match.
+//
+struct trienode {
+    int c;          // character that leads to this node
+    int child;      // first child, 0 if none
+    int sibling;    // next child of the same parent, 0 if none
+    int pattern;    // 1 + index into trie_replace if a pattern ends here
+};
+
+static struct trienode *trie;
+static int trie_nodes, trie_maxnodes;
+static const char **trie_replace;
+static int trie_patterns, trie_maxpatterns;
+
+static void *
+grow(void *base, int *max, size_t size)
+{
+    *max = *max ? 2 * *max : 256;
+    base = realloc(base, *max * size);
+    if (!base) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    return base;
+}
+
+//
+// add a pattern to the trie; "orig" must already be normalized
+// (no whitespace or comments, lower case, unlambda style)
+// if the pattern is already there, the first replacement is kept
+//
+static void
+trie_add(const char *orig, const char *replace)
+{
+    int n = 0;
+    int m;
+
+    if (trie_nodes == 0) {
+        trie = grow(trie, &trie_maxnodes, sizeof(*trie));
+        trie[0].c = trie[0].child = trie[0].sibling = trie[0].pattern = 0;
+        trie_nodes = 1;
+    }
+    for (; *orig; orig++) {
+        for (m = trie[n].child; m && trie[m].c != *orig; m = trie[m].sibling)
+            ;
+        if (!m) {
+            if (trie_nodes == trie_maxnodes) {
+                trie = grow(trie, &trie_maxnodes, sizeof(*trie));
+            }
+            m = trie_nodes++;
+            trie[m].c = *orig;
+            trie[m].child = 0;
+            trie[m].pattern = 0;
+            trie[m].sibling = trie[n].child;
+            trie[n].child = m;
+        }
+        n = m;
+    }
+    if (!trie[n].pattern) {
+        if (trie_patterns == trie_maxpatterns) {
+            trie_replace = grow(trie_replace, &trie_maxpatterns, sizeof(*trie_replace));
+        }
+        trie_replace[trie_patterns++] = replace;
+        trie[n].pattern = trie_patterns;
+    }
+}
+
+static void
+init_opttrie(void)
+{
+    int i;
+
+    if (trie_nodes) return;
+    for (i = 0; i < OPTTAB_SIZE; i++) {
+        trie_add(opttab[i].orig, opttab[i].replace);
+    }
+}
+
+//
+// look for an optimization that matches the input at *s_ptr
+// returns the replacement string and updates s_ptr to point after
+// the match, or returns NULL and leaves s_ptr alone
+//
+static const char *
+match_opt(const char **s_ptr)
+{
+    const char *s = *s_ptr;
+    int n = 0;
+    int c;
+
+    init_opttrie();
+    for(;;) {
+        c = getNextChar(&s);
+        for (n = trie[n].child; n && trie[n].c != c; n = trie[n].sibling)
+            ;
+        if (!n) return NULL;
+        if (trie[n].pattern) {
+            *s_ptr = s;
+            return trie_replace[trie[n].pattern - 1];
+        }
+    }
+}
+
+//
+// read one term from *s_ptr and return it normalized in a new
+// string, or NULL if there is no complete term there
+//
+static char *
+scan_term(const char **s_ptr)
+{
+    const char *s = *s_ptr;
+    char *buf = NULL;
+    int len = 0, max = 0;
+    int need = 1;
+    int c;
+
+    while (need > 0) {
+        c = getNextChar(&s);
+        if (c == '`') {
+            need++;
+        } else if (c == '[') {
+            // copy the number up to the ], leaving out any spaces, as
+            // match_opt never sees them either
+            do {
+                if (len + 1 >= max) buf = grow(buf, &max, 1);
+                buf[len++] = c;
+                do {
+                    c = tolower(*s++);
+                } while (c == ' ' || c == '\n' || c == '\t');
+            } while (c && c != ']');
+            if (!c) break;
+            need--;
+        } else if (c && strchr("skic+", c)) {
+            need--;
+        } else {
+            break;
+        }
+        if (len + 1 >= max) buf = grow(buf, &max, 1);
+        buf[len++] = c;
+    }
+    if (need > 0) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = 0;
+    *s_ptr = s;
+    return buf;
+}
+
+//
+// load more optimizations from a file; the file is a list of
+// pairs of terms, each pattern followed by its replacement
+// returns the number of patterns loaded
+//
+int
+load_patterns(const char *fname)
+{
+    FILE *f;
+    const char *s, *t;
+    char *orig, *replace;
+    int count = 0;
+
+    f = fopen(fname, "r");
+    if (!f) {
+        perror(fname);
+        exit(2);
+    }
+    s = alloc_file(f);
+    fclose(f);
+    init_opttrie();
+    for(;;) {
+        t = s;
+        if (getNextChar(&t) == 0) break;
+        orig = scan_term(&s);
+        replace = orig ? scan_term(&s) : NULL;
+        if (!replace) {
+            fprintf(stderr, "%s: bad pattern after %d patterns\n", fname, count);
+            exit(2);
+        }
+        trie_add(orig, replace);
+        free(orig);
+        count++;
+    }
+    return count;
+}
+
 //
 // parse a subtree
 // modifies *s_ptr to point to the next text past what we
@@ -167,14 +338,10 @@ parse_part_opt(const char **s_ptr, bool opt)
     Cell *r;
 
     if (opt) {
-        int i;
-
         // check for an optimization
-        for (i = 0; i < OPTTAB_SIZE; i++) {
-            if (match_part(s_ptr, opttab[i].orig)) {
-                const char *newptr = opttab[i].replace;
-                return parse_part_opt(&newptr, false);
-            }
+        const char *newptr = match_opt(s_ptr);
+        if (newptr) {
+            return parse_part_opt(&newptr, false);
         }
     }
 
@@ -356,29 +523,75 @@ alloc_file(FILE *f)
     return base;
 }
 
-Cell *parse_whole(FILE *f)
+//
+// parse a whole program, without applying it to anything
+//
+Cell *parse_text(const char *s)
 {
     init_parse();
-    const char *s = alloc_file(f);
-
-    g_root = parse_part(&s);
-
-    // append a lazy read
-    {
-        Cell *readf;
-        Cell *zero;
-        Cell *a1, *a2;
-
-        zero = alloc_cell();
-        readf = alloc_cell();
-        a1 = alloc_cell();
-        a2 = alloc_cell();
-
-        mknum(zero, 0);
-        mkfunc(readf, Read_func, 0);
-        mkapply(a2, readf, zero);
-        mkapply(a1, g_root, a2);
-        g_root = a1;
+    return parse_part(&s);
+}
+
+//
+// is s a complete term that parse_text can read? parse_text aborts on
+// anything else (Iota or Jot, say), which a tool reading many files
+// may want to skip instead
+//
+bool parse_check(const char *s)
+{
+    int need = 1;
+    int c;
+
+    while (need > 0) {
+        c = getNextChar(&s);
+        if (c == '`') {
+            need++;
+        } else if (c == '[') {
+            if (*s == '$') s++;
+            if (*s == ']') return false;
+            while (isalnum((unsigned char)*s)) s++;
+            if (*s++ != ']') return false;
+            need--;
+        } else if (c && strchr("skic+", c)) {
+            need--;
+        } else {
+            return false;
+        }
     }
+    return true;
+}
+
+Cell *parse_program(FILE *f)
+{
+    return parse_text(alloc_file(f));
+}
+
+//
+// apply a program to a lazy read of the input
+//
+Cell *apply_input(Cell *prog)
+{
+    Cell *readf;
+    Cell *zero;
+    Cell *a1, *a2;
+
+    push_root(prog);
+    zero = alloc_cell();
+    readf = alloc_cell();
+    a1 = alloc_cell();
+    a2 = alloc_cell();
+
+    mknum(zero, 0);
+    mkfunc(readf, Read_func, 0);
+    mkapply(a2, readf, zero);
+    mkapply(a1, prog, a2);
+    pop_root();
+    return a1;
+}
+
+Cell *parse_whole(FILE *f)
+{
+    g_root = parse_program(f);
+    g_root = apply_input(g_root);
     return g_root;
 }
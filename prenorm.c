@@ -0,0 +1,305 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+//
+// partial normalisation of a program before it is run
+//
+// A program is a closed term, so any redex in it can be reduced
+// before the program ever sees its input, and the answer will be the
+// same as if it had been reduced at run time. We walk the whole
+// graph trying to reduce every apply node we find to weak head
+// normal form, in place, so that sharing is kept.
+//
+// Reducing things the program might never have needed can blow up
+// (think of the Y combinator), so each node is a trial: every cell
+// the reductions overwrite is saved first, and if the node has not
+// settled within PRENORM_NODE_STEPS reductions, or the live graph has
+// got bigger, the saved cells are put back and the node is left as
+// it was. The pass as a whole also has a reduction budget, and the
+// graph may never grow past a fixed limit.
+//
+// Inc and Read are left alone: Inc insists on a number as its
+// argument, and Read would consume input.
+//
+
+#include <stdlib.h>
+#include "lazy.h"
+
+// reductions allowed on any one node, and on the whole program
+#define PRENORM_NODE_STEPS 256
+#define PRENORM_STEPS 200000L
+// how much one node may grow the graph by
+#define PRENORM_NODE_GROWTH 0
+// the live graph may never grow by more than this many cells,
+// plus 1/4 of its size
+#define PRENORM_GROWTH 256L
+
+static unsigned long steps;
+static long live;
+static long limit;
+
+//
+// undo log for the node being reduced; both arrays are gc roots,
+// so neither the overwritten cells nor their old contents can be
+// reclaimed while the trial is running
+//
+#define UNDO_MAX (2*PRENORM_NODE_STEPS)
+static Cell *undo_cell[UNDO_MAX];
+static Cell *undo_saved[UNDO_MAX];
+static int undo_top;
+
+//
+// count the live cells (this runs a gc)
+//
+static long
+live_cells(void)
+{
+    long n;
+    Cell *c;
+
+    gc();
+    n = heap_top - &mem[0];
+    for (c = free_list; c; c = getstack(c)) {
+        n -= getrunend(c) - c;
+    }
+    return n;
+}
+
+//
+// overwrite cell c with a copy of x
+//
+static void
+copy_cell(Cell *c, Cell *x)
+{
+    CellType t = gettype(x);
+
+    switch (t) {
+    case CT_A_PAIR:
+    case CT_S2_PAIR:
+    case CT_C2_PAIR:
+    case CT_NUM_PAIR:
+        mkpair(c, getleft(x), getright(x), t);
+        break;
+    case CT_FUNC:
+        mkfunc(c, getfunc(x), getarg(x));
+        break;
+    case CT_NUM:
+        mknum(c, getnum(x));
+        break;
+    default:
+        fatal("prenorm: bad cell type");
+        break;
+    }
+}
+
+//
+// remember the contents of c before it is overwritten
+//
+static void
+save_cell(Cell *c)
+{
+    Cell *s;
+
+    if (undo_top >= UNDO_MAX) {
+        fatal("prenorm: undo log overflow");
+    }
+    undo_cell[undo_top] = c;
+    s = alloc_cell();
+    copy_cell(s, c);
+    undo_saved[undo_top++] = s;
+}
+
+static void
+undo_node(bool keep)
+{
+    while (undo_top > 0) {
+        --undo_top;
+        if (!keep) {
+            copy_cell(undo_cell[undo_top], undo_saved[undo_top]);
+        }
+        undo_cell[undo_top] = undo_saved[undo_top] = NULL;
+    }
+}
+
+//
+// try to reduce an apply node to weak head normal form, in place
+// this is partial_eval one step at a time, except that when the
+// top node reduces to some other cell we copy that cell into it
+// (nothing outside the spine knows where the result ended up)
+//
+static void
+prenorm_node(Cell *top)
+{
+    Cell *prev, *cur, *lhs, *r;
+    int n;
+    long after;
+    bool settled = false;
+    bool allocated = false;
+
+    push_root(top);
+    for (n = 0; n < PRENORM_NODE_STEPS && steps < PRENORM_STEPS; n++) {
+        if (gettype(top) != CT_A_PAIR) {
+            settled = true;
+            break;
+        }
+        prev = NULL;
+        cur = top;
+        while (gettype(getleft(cur)) == CT_A_PAIR) {
+            prev = cur;
+            cur = getleft(cur);
+        }
+        lhs = getleft(cur);
+        if (gettype(lhs) == CT_FUNC
+            && (getfunc(lhs) == Inc_func || getfunc(lhs) == Read_func))
+        {
+            settled = true;
+            break;
+        }
+        switch (gettype(lhs)) {
+        case CT_S2_PAIR:
+        case CT_C2_PAIR:
+        case CT_NUM_PAIR:
+            allocated = true;
+            break;
+        default:
+            break;
+        }
+        save_cell(cur);
+        r = partial_apply_primitive(cur);
+        if (r != cur) {
+            push_root(r);
+            if (prev) {
+                save_cell(prev);
+                setleft(prev, r);
+                addref(r);
+            } else {
+                save_cell(top);
+                copy_cell(top, r);
+            }
+            pop_root();
+        }
+        ++steps;
+    }
+    if (n > 0 && !allocated) {
+        // only the pairs allocate, so the graph can't have grown
+        undo_node(true);
+    } else if (n > 0) {
+        // the saved copies are live for now, but won't be for long
+        after = live_cells() - undo_top;
+        if (after <= live || (settled && after <= live + PRENORM_NODE_GROWTH
+                              && after <= limit))
+        {
+            undo_node(true);
+            live = after;
+        } else {
+            undo_node(false);
+        }
+    }
+    pop_root();
+}
+
+//
+// normalise a program; returns the (possibly changed) program
+//
+Cell *
+prenorm(Cell *prog, bool verbose)
+{
+    unsigned char *visited;
+    Cell **stack;
+    int sp, stacksize;
+    long before, after;
+    Cell *c;
+
+    static bool registered = false;
+
+    if (!registered) {
+        add_roots(undo_cell, UNDO_MAX);
+        add_roots(undo_saved, UNDO_MAX);
+        registered = true;
+    }
+    push_root(prog);
+    before = live = live_cells();
+    limit = before + before/4 + PRENORM_GROWTH;
+    // a trial may allocate 3 cells per reduction plus its undo log
+    // before we get to check on it, and the input needs room too
+    if (limit > NUMCELLS - 6*PRENORM_NODE_STEPS) {
+        limit = NUMCELLS - 6*PRENORM_NODE_STEPS;
+    }
+    steps = 0;
+
+    // cells may be freed and reused while we walk, so entries on the
+    // stack can go stale; that is harmless, since a reused cell is
+    // live again and a freed one has type CT_FREE
+    visited = calloc(NUMCELLS, 1);
+    stacksize = 1024;
+    stack = malloc(stacksize * sizeof(*stack));
+    if (!visited || !stack) {
+        fatal("prenorm: out of memory");
+    }
+    sp = 0;
+    stack[sp++] = prog;
+    while (sp > 0 && steps < PRENORM_STEPS && live < limit) {
+        c = stack[--sp];
+        if (visited[c - &mem[0]]) continue;
+        visited[c - &mem[0]] = 1;
+        if (gettype(c) == CT_A_PAIR) {
+            prenorm_node(c);
+        }
+        if (sp + 2 > stacksize) {
+            stacksize *= 2;
+            stack = realloc(stack, stacksize * sizeof(*stack));
+            if (!stack) {
+                fatal("prenorm: out of memory");
+            }
+        }
+        switch (gettype(c)) {
+        case CT_A_PAIR:
+        case CT_S2_PAIR:
+        case CT_C2_PAIR:
+        case CT_NUM_PAIR:
+            stack[sp++] = getright(c);
+            stack[sp++] = getleft(c);
+            break;
+        case CT_FUNC:
+            if (getarg(c)) stack[sp++] = getarg(c);
+            break;
+        default:
+            break;
+        }
+    }
+    free(stack);
+    free(visited);
+
+    after = live_cells();
+    if (verbose) {
+        fprintf(stderr, "prenorm: %lu reductions, %ld -> %ld cells%s\n",
+                steps, before, after,
+                steps >= PRENORM_STEPS ? " (budget exhausted)" : "");
+    }
+    pop_root();
+    return prog;
+}
@@ -51,4 +51,10 @@ AFUNC void setused(Cell *c, bool yes) { c->p.used = yes ? 1 : 0; }
 #define setfunc(c, f) setleft(c, (Cell *)(f))
 #define setarg(c, a) setright(c, a)
 
+// no room for reference counts; nothing is ever unique
+#define clearrefs(c)
+#define addref(c)
+#define setshared(c)
+#define isunique(c) false
+
 #endif
@@ -0,0 +1,79 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// layout of the cells in a Propeller image, shared by the compiler
+// (which writes images) and propsim (which runs them)
+//
+// each cell is one long: bits 0-2 hold the type, bit 3 is the gc mark,
+// and the rest is either a 28 bit number or two 14 bit pointers;
+// pointers (and function addresses) are hub addresses divided by 4,
+// see propeller-cell.h
+//
+
+#ifndef PROPIMAGE_H
+#define PROPIMAGE_H
+
+#include <stdint.h>
+
+// shifts to extract left/right nodes from a cell
+#define LHS_SHIFT 4
+#define RHS_SHIFT 18
+#define NUM_SHIFT 4
+
+// convert Propeller address to 14 bits
+#define ADDR(x) (((x)>>2) & 0x3fff)
+
+// hub RAM size
+#define PROPELLER_HUB_SIZE 32768
+
+#ifdef NO_RUNTIME
+//
+// without PropGCC there is no runtime to put in front of the cells,
+// and no real addresses for the CellFuncs; images built this way
+// can only be run by propsim
+//
+static const uint8_t runtime_binary[] = { 0 };
+
+struct map { CellFunc *fn; uint32_t addr; } fnmap[] = {
+    {&K1_func,  0x0040},
+    {&K_func,   0x0044},
+    {&KI_func,  0x0048},
+    {&S1_func,  0x004c},
+    {&S_func,   0x0050},
+    {&Inc_func, 0x0054},
+    {&C1_func,  0x0058},
+    {&C_func,   0x005c},
+    {&Read_func,0x0060},
+};
+#else
+#include "runtime_bin.h"
+#include "fnmap.h"
+#endif
+
+#endif
@@ -0,0 +1,277 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+//
+// run a proplazy .binary image on the host
+//
+// The cells are decoded from the image exactly as the runtime sees
+// them (see propeller-cell.h) and then evaluated by the ordinary
+// evaluator, built with the Propeller's memory limits (-DSMALL), so
+// a program that runs out of cells or root stack here will do the
+// same on the real thing.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "lazy.h"
+#include "propimage.h"
+
+static const char *gl_name = "propsim";
+static unsigned long gl_outmax;
+static unsigned long gl_outcount;
+static int gl_imagecells;
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "Usage: %s [-q][-m count] file.binary\n", gl_name);
+    fprintf(stderr, "  -q:       don't print statistics\n");
+    fprintf(stderr, "  -m count: stop after count bytes of output\n");
+    exit(2);
+}
+
+static uint32_t
+getlong(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static Cell *
+decodeAddr(uint32_t a)
+{
+    uint32_t addr;
+
+    if (a == 0) return NULL;
+    addr = a << 2;
+    if (addr < PROPELLER_MEM_ADDR || addr >= PROPELLER_MEM_ADDR + 4*gl_imagecells) {
+        fprintf(stderr, "%s: bad cell address %x in image\n", gl_name, addr);
+        exit(1);
+    }
+    return &mem[(addr - PROPELLER_MEM_ADDR) / 4];
+}
+
+static CellFunc *
+decodeFunc(uint32_t a)
+{
+    int i;
+
+    for (i = 0; i < sizeof(fnmap)/sizeof(fnmap[0]); i++) {
+        if (ADDR(fnmap[i].addr) == a) {
+            return fnmap[i].fn;
+        }
+    }
+    fprintf(stderr, "%s: unknown function address %x in image\n", gl_name, a << 2);
+    exit(1);
+}
+
+//
+// decode the cells reachable from root; anything else (including
+// the checksum at the end of the image) is left free, as the
+// runtime's first gc would leave it
+//
+static void
+decodeCells(const uint32_t *img, Cell *root)
+{
+    Cell **stack;
+    int sp = 0;
+    Cell *c;
+    uint32_t x, left, right;
+    CellType t;
+
+    stack = malloc(sizeof(*stack) * 2 * (gl_imagecells + 1));
+    if (!stack) fatal("out of memory");
+    stack[sp++] = root;
+    while (sp > 0) {
+        c = stack[--sp];
+        if (gettype(c) != CT_FREE) continue;
+        x = img[c - &mem[0]];
+        t = (CellType)(x & 0x7);
+        left = (x >> LHS_SHIFT) & 0x3fff;
+        right = (x >> RHS_SHIFT) & 0x3fff;
+        switch (t) {
+        case CT_A_PAIR:
+        case CT_S2_PAIR:
+        case CT_C2_PAIR:
+        case CT_NUM_PAIR:
+            mkpair(c, decodeAddr(left), decodeAddr(right), t);
+            if (getleft(c)) stack[sp++] = getleft(c);
+            if (getright(c)) stack[sp++] = getright(c);
+            break;
+        case CT_FUNC:
+            mkfunc(c, decodeFunc(left), decodeAddr(right));
+            if (getarg(c)) stack[sp++] = getarg(c);
+            break;
+        case CT_NUM:
+            mknum(c, x >> NUM_SHIFT);
+            break;
+        default:
+            fprintf(stderr, "%s: bad cell type %d at %x\n", gl_name, t,
+                    (unsigned)(PROPELLER_MEM_ADDR + 4*(c - &mem[0])));
+            exit(1);
+        }
+    }
+    free(stack);
+}
+
+static bool gl_quiet;
+
+static void
+report(const char *status)
+{
+    if (gl_quiet) return;
+    fflush(stdout);
+    fprintf(stderr, "%s: %s\n", gl_name, status);
+    fprintf(stderr, "  image cells:     %d of %d\n", gl_imagecells, NUMCELLS);
+    fprintf(stderr, "  reductions:      %lu\n", gl_reductions);
+    fprintf(stderr, "  garbage collects: %lu\n", gl_gcs);
+    fprintf(stderr, "  peak live cells: %lu of %d\n", gl_peak_live, NUMCELLS);
+    fprintf(stderr, "  output bytes:    %lu\n", gl_outcount);
+}
+
+// fatal() aborts, which is how running out of cells shows up
+static void
+on_abort(int sig)
+{
+    report("program does not fit");
+    _exit(1);
+}
+
+//
+// eval_loop, with a limit on the output
+//
+static int
+run(void)
+{
+    int outc;
+    Cell *head;
+
+    for(;;) {
+        if (gl_outmax && gl_outcount >= gl_outmax) {
+            return 0;
+        }
+        g_root = partial_eval(g_root);
+        setshared(g_root);
+        head = car(g_root);
+        outc = getintvalue(head);
+        if (outc >= 256) {
+            return outc - 256;
+        }
+        putch(outc);
+        gl_outcount++;
+        g_root = cdr(g_root);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *f;
+    uint8_t *image;
+    long size;
+    uint32_t *cells;
+    uint8_t sum;
+    int i, r;
+
+    gl_name = argv[0];
+    argv++; --argc;
+    while (argv[0] && argv[0][0] == '-') {
+        switch (argv[0][1]) {
+        case 'q':
+            gl_quiet = true;
+            break;
+        case 'm':
+            if (!argv[1]) Usage();
+            gl_outmax = strtoul(argv[1], NULL, 0);
+            argv++; --argc;
+            break;
+        default:
+            Usage();
+            break;
+        }
+        argv++; --argc;
+    }
+    if (argc != 1) {
+        Usage();
+    }
+    f = fopen(argv[0], "rb");
+    if (!f) {
+        perror(argv[0]);
+        return 1;
+    }
+    image = malloc(PROPELLER_HUB_SIZE + 1);
+    if (!image) fatal("out of memory");
+    size = fread(image, 1, PROPELLER_HUB_SIZE + 1, f);
+    fclose(f);
+    if (size > PROPELLER_HUB_SIZE) {
+        fprintf(stderr, "%s: image is bigger than hub memory\n", gl_name);
+        return 1;
+    }
+    if (size < PROPELLER_MEM_ADDR + 4 || (size & 3) != 0) {
+        fprintf(stderr, "%s: %s is not a proplazy image\n", gl_name, argv[0]);
+        return 1;
+    }
+    sum = 0;
+    for (i = 0; i < size; i++) {
+        sum += image[i];
+    }
+    if (sum != 0x14) {
+        fprintf(stderr, "%s: warning: bad checksum\n", gl_name);
+    }
+
+    // the last long holds the checksum, and isn't a real cell
+    gl_imagecells = (size - PROPELLER_MEM_ADDR) / 4 - 1;
+    if (gl_imagecells > NUMCELLS) {
+        fprintf(stderr, "%s: image has %d cells, but the runtime only has room for %d\n",
+                gl_name, gl_imagecells, NUMCELLS);
+        return 1;
+    }
+    cells = malloc(4 * (gl_imagecells + 1));
+    if (!cells) fatal("out of memory");
+    for (i = 0; i <= gl_imagecells; i++) {
+        cells[i] = getlong(image + PROPELLER_MEM_ADDR + 4*i);
+    }
+    g_root = decodeAddr(ADDR(getlong(image + PROPELLER_BASE)));
+    if (!g_root) {
+        fprintf(stderr, "%s: image has no root\n", gl_name);
+        return 1;
+    }
+    decodeCells(cells, g_root);
+    free(cells);
+    free(image);
+
+    // like the runtime, start with every cell loaded and let the
+    // first gc build the free list
+    heap_top = &mem[NUMCELLS];
+    free_list = NULL;
+
+    signal(SIGABRT, on_abort);
+    r = run();
+    report("ok");
+    return r;
+}
@@ -0,0 +1,778 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// cooperative scheduler for the host interpreter
+//
+// Instead of forking a process per job, run many jobs as coroutines
+// in one heap. Each job has its own C stack, root stack and g_root;
+// we switch between them only where a gc could happen anyway (at a
+// reduction, or when Read_func asks for a character), so a suspended
+// job's roots look just like those of a job waiting on alloc_cell.
+// A job runs until it has used up its slice of reductions (its
+// fuel) or needs input that hasn't arrived yet, and then the next
+// job gets a turn. Jobs that go over their limits on reductions or
+// live cells are stopped.
+//
+// Jobs share the heap but not their graphs: each parses its own
+// copy of the program, since a graph node that one job has started
+// to reduce must not be overwritten under it by another. A frozen
+// program (gl_shared_prog) is never overwritten, so the jobs can all
+// share that, each with its own thaw map.
+//
+
+#define _GNU_SOURCE     // for accept4
+#include <stdlib.h>
+#include <string.h>
+#include "lazy.h"
+
+#ifdef _WIN32
+
+int serve_sched(const char *prog, int maxjobs, unsigned long quantum,
+                unsigned long maxfuel, unsigned long maxcells)
+{
+    fatal("scheduler mode is not supported on this platform");
+    return 1;
+}
+
+int serve_socket(const char *path, const char *prog, int maxjobs,
+                 unsigned long quantum, unsigned long maxfuel, unsigned long maxcells)
+{
+    fatal("socket mode is not supported on this platform");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+// C stack for each job; this is only address space until it is
+// used, and the gc can recurse deeply
+#define JOB_STACK_SIZE (8*1024*1024)
+
+// statuses for jobs we stop, as though a signal had killed them
+#define STATUS_FUEL (128 + SIGXCPU)
+#define STATUS_CELLS (128 + SIGKILL)
+#define STATUS_ERROR (128 + SIGABRT)
+
+typedef enum JobState {
+    JOB_READY,
+    JOB_WAITING,        // for more input
+    JOB_DONE,
+} JobState;
+
+typedef struct sjob {
+    struct sjob *next;
+    ucontext_t ctx;
+    char *stack;
+    JobState state;
+    int id;
+    int status;
+    double start;
+
+    // evaluator state while the job is switched out
+    Cell *root;
+    Cell **roots;
+    int top;
+    ThawMap *thaw;
+
+    unsigned long used;     // reductions so far
+    unsigned long live;     // cells it was using at the last gc
+    bool over;              // went over maxcells
+
+    unsigned char *in;
+    size_t inlen, inpos, inmax;
+    bool inclosed;          // all of the input has arrived
+    unsigned char *out;
+    size_t outlen, outmax;
+    LazyIO io;              // reads from in and writes to out
+
+    // socket mode
+    int fd;
+    size_t outsent;         // how much of out has gone
+    unsigned events;        // what epoll is watching for
+} SJob;
+
+static SJob *joblist;
+static int numrunning;
+static SJob *cur_job;
+static ucontext_t sched_ctx;
+
+static unsigned long gl_quantum, gl_maxfuel, gl_maxcells;
+
+Cell *gl_shared_prog;
+static unsigned long slice_begin;
+
+// the scheduler's own evaluator state while a job runs
+static Cell *main_root;
+static Cell **main_roots;
+static int main_top;
+static ThawMap *main_thaw;
+static LazyIO *main_io;
+
+// the buffers between the evaluator and a job's in and out
+#define JOB_IOSIZE 4096
+
+// in socket mode a job isn't run while this much of its output is
+// waiting to be sent, so that a client that doesn't read can't have
+// us buffer its output without end
+#define JOB_OUTMAX (64*1024)
+static bool gl_throttle;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+static void
+append(unsigned char **buf, size_t *len, size_t *max, const void *data, size_t n)
+{
+    if (*len + n > *max) {
+        while (*len + n > *max) {
+            *max = *max ? 2 * *max : 256;
+        }
+        *buf = xrealloc(*buf, *max);
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+}
+
+//
+// go back to the scheduler; the job's state says why
+//
+static void
+switch_out(SJob *J)
+{
+    swapcontext(&J->ctx, &sched_ctx);
+}
+
+static size_t
+sched_read(LazyIO *io, unsigned char *buf, size_t len)
+{
+    SJob *J = io->data;
+
+    while (J->inpos == J->inlen) {
+        if (J->inclosed) return 0;
+        J->state = JOB_WAITING;
+        switch_out(J);
+    }
+    if (len > J->inlen - J->inpos) {
+        len = J->inlen - J->inpos;
+    }
+    memcpy(buf, J->in + J->inpos, len);
+    J->inpos += len;
+    return len;
+}
+
+static void
+sched_write(LazyIO *io, const unsigned char *buf, size_t len)
+{
+    SJob *J = io->data;
+
+    append(&J->out, &J->outlen, &J->outmax, buf, len);
+}
+
+//
+// called from partial_eval at the end of a slice
+//
+static void
+slice_end(void)
+{
+    SJob *J = cur_job;
+
+    if (J->over) {
+        J->status = STATUS_CELLS;
+        J->state = JOB_DONE;
+    } else if (gl_maxfuel && J->used + (gl_reductions - slice_begin) >= gl_maxfuel) {
+        J->status = STATUS_FUEL;
+        J->state = JOB_DONE;
+    } else {
+        J->state = JOB_READY;
+    }
+    switch_out(J);
+}
+
+//
+// called from fatal; an error in a job ends just that job, with the
+// message at the end of its output, and its graph is left for the gc
+//
+static void
+job_fatal(const char *msg)
+{
+    SJob *J = cur_job;
+
+    if (!J) return;
+    io_flush(&J->io);
+    append(&J->out, &J->outlen, &J->outmax, msg, strlen(msg));
+    append(&J->out, &J->outlen, &J->outmax, "\r\n", 2);
+    J->status = STATUS_ERROR;
+    J->state = JOB_DONE;
+    switch_out(J);
+}
+
+//
+// mark the roots of every job (and the scheduler's), noting how many
+// cells each job is using; the running job's roots are the globals
+//
+static void
+sched_gc(void)
+{
+    SJob *J;
+
+    if (cur_job) {
+        gc_mark_roots(&main_root, 1);
+        gc_mark_roots(main_roots, main_top);
+    }
+    for (J = joblist; J; J = J->next) {
+        if (J == cur_job) {
+            J->live = gc_mark_roots(&g_root, 1);
+            J->live += gc_mark_roots(root_stack, root_stack_top);
+        } else {
+            J->live = gc_mark_roots(&J->root, 1);
+            J->live += gc_mark_roots(J->roots, J->top);
+        }
+        if (gl_maxcells && J->live > gl_maxcells) {
+            J->over = true;
+            if (J == cur_job) {
+                // stop at the next reduction
+                gl_slice_end = gl_reductions + 1;
+            }
+        }
+    }
+}
+
+static void
+job_main(void)
+{
+    SJob *J = cur_job;
+
+    J->status = eval_loop() & 0xff;
+    J->state = JOB_DONE;
+    // returning goes back to sched_ctx
+}
+
+static SJob *
+new_job(const char *prog, int id)
+{
+    SJob *J = xrealloc(NULL, sizeof(SJob));
+
+    memset(J, 0, sizeof(SJob));
+    J->id = id;
+    J->start = job_clock();
+    J->roots = xrealloc(NULL, ROOT_STACK_SIZE * sizeof(Cell *));
+    J->stack = mmap(NULL, JOB_STACK_SIZE, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (J->stack == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    // a guard page, so that running off the end faults
+    mprotect(J->stack, getpagesize(), PROT_NONE);
+
+    getcontext(&J->ctx);
+    J->ctx.uc_stack.ss_sp = J->stack;
+    J->ctx.uc_stack.ss_size = JOB_STACK_SIZE;
+    J->ctx.uc_link = &sched_ctx;
+    makecontext(&J->ctx, job_main, 0);
+    io_init(&J->io, sched_read, sched_write, J, JOB_IOSIZE, JOB_IOSIZE);
+
+    if (gl_shared_prog) {
+        J->thaw = new_thaw_map();
+        J->root = apply_input(gl_shared_prog);
+    } else {
+        // loaded as in every other mode; prepare_program leaves the
+        // program in g_root, which is the scheduler's own here
+        Cell *saved = g_root;
+        J->root = apply_input(prepare_program(prog, false, false));
+        g_root = saved;
+    }
+    J->next = joblist;
+    joblist = J;
+    numrunning++;
+    return J;
+}
+
+static void
+free_job(SJob *J)
+{
+    SJob **p;
+
+    for (p = &joblist; *p != J; p = &(*p)->next)
+        ;
+    *p = J->next;
+    munmap(J->stack, JOB_STACK_SIZE);
+    free(J->roots);
+    if (J->thaw) {
+        free_thaw_map(J->thaw);
+    }
+    io_release(&J->io);
+    free(J->in);
+    free(J->out);
+    free(J);
+}
+
+//
+// give a job one slice
+//
+static void
+run_job(SJob *J)
+{
+    unsigned long slice = gl_quantum;
+
+    main_root = g_root;
+    main_roots = root_stack;
+    main_top = root_stack_top;
+    g_root = J->root;
+    root_stack = J->roots;
+    root_stack_top = J->top;
+    main_thaw = gl_thaw;
+    gl_thaw = J->thaw;
+    main_io = gl_io;
+    gl_io = &J->io;
+
+    if (gl_maxfuel && gl_maxfuel - J->used < slice) {
+        slice = gl_maxfuel - J->used;
+    }
+    slice_begin = gl_reductions;
+    gl_slice_end = slice_begin + slice;
+    J->state = JOB_READY;
+    cur_job = J;
+    swapcontext(&sched_ctx, &J->ctx);
+    cur_job = NULL;
+    gl_slice_end = 0;
+    J->used += gl_reductions - slice_begin;
+
+    J->root = g_root;
+    J->top = root_stack_top;
+    g_root = main_root;
+    root_stack = main_roots;
+    root_stack_top = main_top;
+    gl_thaw = main_thaw;
+    // what the job wrote this slice goes out now
+    io_flush(&J->io);
+    gl_io = main_io;
+}
+
+static void
+set_limits(unsigned long quantum, unsigned long maxfuel, unsigned long maxcells)
+{
+    gl_quantum = quantum;
+    gl_maxfuel = maxfuel;
+    gl_maxcells = maxcells;
+    gl_gc_hook = sched_gc;
+    gl_slice_hook = slice_end;
+    gl_fatal_hook = job_fatal;
+}
+
+static bool
+can_run(SJob *J)
+{
+    if (gl_throttle && J->outlen - J->outsent >= JOB_OUTMAX) return false;
+    if (J->state == JOB_READY) return true;
+    return J->state == JOB_WAITING && (J->inpos < J->inlen || J->inclosed);
+}
+
+static bool
+any_can_run(void)
+{
+    SJob *J;
+
+    for (J = joblist; J; J = J->next) {
+        if (can_run(J)) return true;
+    }
+    return false;
+}
+
+//
+// give every job that can run a slice; "done" is called for each
+// one that finishes (or is stopped)
+//
+static void
+run_jobs(void (*done)(SJob *))
+{
+    SJob *J, *next;
+
+    for (J = joblist; J; J = next) {
+        next = J->next;
+        if (J->state == JOB_DONE) {
+            continue;
+        }
+        if (J->over) {
+            J->status = STATUS_CELLS;
+            J->state = JOB_DONE;
+        } else if (can_run(J)) {
+            run_job(J);
+        } else {
+            continue;
+        }
+        if (J->state == JOB_DONE) {
+            // its graph is garbage now
+            J->root = NULL;
+            J->top = 0;
+            numrunning--;
+            note_latency(job_clock() - J->start,
+                         J->status == STATUS_FUEL || J->status == STATUS_CELLS ||
+                         J->status == STATUS_ERROR);
+            (*done)(J);
+        }
+    }
+}
+
+//
+// framed stdin, as for serve_frames, except that a job starts as soon
+// as its header has been read and its input is passed on as it comes;
+// at most maxjobs jobs run at once, and later ones wait unread
+//
+static SJob *filling;       // job whose input we are reading
+
+// write a finished job's result in the same form as serve_frames
+static void
+frame_done(SJob *J)
+{
+    char hdr[64];
+
+    if (J == filling) {
+        // it stopped before reading all of its input
+        filling = NULL;
+    }
+    snprintf(hdr, sizeof(hdr), "%d %d %lu\n", J->id, J->status,
+             (unsigned long)J->outlen);
+    write_all(hdr, strlen(hdr));
+    write_all(J->out, J->outlen);
+    free_job(J);
+}
+
+int
+serve_sched(const char *prog, int maxjobs, unsigned long quantum,
+            unsigned long maxfuel, unsigned long maxcells)
+{
+    static unsigned char buf[65536];
+    size_t bufpos = 0, buflen = 0;
+    struct pollfd pfd;
+    long remaining = 0;     // bytes of filling's input still to come
+    long len = 0;
+    bool inheader = false;
+    bool eof = false;
+    int id = 0;
+    ssize_t n;
+    size_t k;
+    double start;
+
+    set_limits(quantum, maxfuel, maxcells);
+    start = job_clock();
+
+    for(;;) {
+        if (eof && !joblist && bufpos == buflen) break;
+
+        // take whatever input is there; wait for some if nothing
+        // else can run
+        if (!eof && bufpos == buflen) {
+            pfd.fd = 0;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, any_can_run() ? 0 : -1) > 0) {
+                n = read(0, buf, sizeof(buf));
+                if (n <= 0) {
+                    if (inheader || remaining > 0) {
+                        fprintf(stderr, "short frame for job %d\n", id - (remaining > 0));
+                        exit(1);
+                    }
+                    eof = true;
+                    n = 0;
+                }
+                bufpos = 0;
+                buflen = n;
+            }
+        }
+        while (bufpos < buflen) {
+            if (remaining > 0) {
+                k = buflen - bufpos;
+                if (k > remaining) k = remaining;
+                // (if the job has finished already, drop it)
+                if (filling) {
+                    append(&filling->in, &filling->inlen, &filling->inmax, buf + bufpos, k);
+                }
+                bufpos += k;
+                remaining -= k;
+                if (remaining == 0 && filling) filling->inclosed = true;
+                continue;
+            }
+            if (!inheader && numrunning >= maxjobs) {
+                break;
+            }
+            if (buf[bufpos] >= '0' && buf[bufpos] <= '9') {
+                len = 10*len + (buf[bufpos++] - '0');
+                inheader = true;
+                continue;
+            }
+            if (buf[bufpos] != '\n' || !inheader) {
+                fprintf(stderr, "bad frame header for job %d\n", id);
+                exit(1);
+            }
+            bufpos++;
+            filling = new_job(prog, id++);
+            remaining = len;
+            if (remaining == 0) filling->inclosed = true;
+            len = 0;
+            inheader = false;
+        }
+
+        run_jobs(frame_done);
+    }
+    report_jobs(job_clock() - start);
+    return 0;
+}
+
+//
+// Unix domain socket service
+// each connection is a job: what the client sends is its input (the
+// client shuts down its side of the connection for end of input),
+// and its output is sent back as it is produced; when the job
+// finishes we close the connection. An epoll loop takes care of all
+// the connections, and jobs waiting for input just aren't run.
+//
+static int epfd;
+static int listenfd;
+static int sock_maxjobs;
+static bool listening;
+
+static void
+watch_fd(int op, int fd, unsigned events, void *ptr)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = ptr;
+    if (epoll_ctl(epfd, op, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+static void
+close_job(SJob *J)
+{
+    if (J->state != JOB_DONE) {
+        numrunning--;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, J->fd, NULL);
+    close(J->fd);
+    free_job(J);
+}
+
+//
+// send what we can of a job's output, and say which events we are
+// waiting for on its connection; closes it once a finished job's
+// output has all gone
+//
+static void
+flush_job(SJob *J)
+{
+    ssize_t r;
+    unsigned events = 0;
+
+    while (J->outsent < J->outlen) {
+        r = send(J->fd, J->out + J->outsent, J->outlen - J->outsent, MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            // the client has gone away
+            close_job(J);
+            return;
+        }
+        J->outsent += r;
+    }
+    if (J->outsent == J->outlen) {
+        J->outsent = J->outlen = 0;
+        if (J->state == JOB_DONE) {
+            close_job(J);
+            return;
+        }
+    } else {
+        // keep only what is still to go, so the buffer stays
+        // about JOB_OUTMAX however slowly the client reads
+        memmove(J->out, J->out + J->outsent, J->outlen - J->outsent);
+        J->outlen -= J->outsent;
+        J->outsent = 0;
+        events |= EPOLLOUT;
+    }
+    if (!J->inclosed) {
+        events |= EPOLLIN;
+    }
+    if (events != J->events) {
+        watch_fd(EPOLL_CTL_MOD, J->fd, events, J);
+        J->events = events;
+    }
+}
+
+static void
+sock_done(SJob *J)
+{
+    flush_job(J);
+}
+
+//
+// read what the client has sent
+//
+static void
+fill_job(SJob *J)
+{
+    unsigned char buf[4096];
+    ssize_t r;
+
+    for(;;) {
+        r = read(J->fd, buf, sizeof(buf));
+        if (r > 0) {
+            // a finished job doesn't want it
+            if (J->state != JOB_DONE) {
+                append(&J->in, &J->inlen, &J->inmax, buf, r);
+            }
+            continue;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (r < 0 && errno != ECONNRESET) {
+            perror("read");
+        }
+        J->inclosed = true;
+        return;
+    }
+}
+
+static void
+accept_jobs(const char *prog, int *id)
+{
+    int fd;
+    SJob *J;
+
+    while (numrunning < sock_maxjobs) {
+        fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        J = new_job(prog, (*id)++);
+        J->fd = fd;
+        J->events = EPOLLIN;
+        watch_fd(EPOLL_CTL_ADD, fd, EPOLLIN, J);
+    }
+    // full up; leave the rest in the listen queue
+    watch_fd(EPOLL_CTL_MOD, listenfd, 0, NULL);
+    listening = false;
+}
+
+int
+serve_socket(const char *path, const char *prog, int maxjobs,
+             unsigned long quantum, unsigned long maxfuel, unsigned long maxcells)
+{
+    struct sockaddr_un addr;
+    struct epoll_event events[64];
+    SJob *J, *next;
+    int id = 0;
+    int n, i;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return 1;
+    }
+    listenfd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (listenfd < 0) {
+        perror("socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(listenfd, 128) < 0) {
+        perror(path);
+        return 1;
+    }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    sock_maxjobs = maxjobs;
+    watch_fd(EPOLL_CTL_ADD, listenfd, EPOLLIN, NULL);
+    listening = true;
+    set_limits(quantum, maxfuel, maxcells);
+    gl_throttle = true;
+
+    for(;;) {
+        n = epoll_wait(epfd, events, 64, any_can_run() ? 0 : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return 1;
+        }
+        for (i = 0; i < n; i++) {
+            J = events[i].data.ptr;
+            if (!J) {
+                accept_jobs(prog, &id);
+                continue;
+            }
+            if (events[i].events & (EPOLLHUP|EPOLLERR)) {
+                // the client has closed both ways, so nobody
+                // wants the output
+                close_job(J);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                fill_job(J);
+            }
+            flush_job(J);
+        }
+        run_jobs(sock_done);
+        for (J = joblist; J; J = next) {
+            next = J->next;
+            if (J->outlen > J->outsent) {
+                flush_job(J);
+            }
+        }
+        if (!listening && numrunning < sock_maxjobs) {
+            watch_fd(EPOLL_CTL_MOD, listenfd, EPOLLIN, NULL);
+            listening = true;
+        }
+    }
+    return 0;
+}
+
+#endif
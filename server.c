@@ -0,0 +1,628 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// batch server for the host interpreter
+//
+// Parsing a program and setting up its heap costs far more than
+// running it on a small input, so in server mode we parse once and
+// then run every job in a fork() of the ready heap. The program graph
+// is shared copy-on-write with the parent, and throwing the child
+// away is the per-job reset: the parent never evaluates anything, and
+// a child only touches the heap pages it actually allocates from.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "lazy.h"
+
+#ifdef _WIN32
+
+int serve_spool(const char *dir, int maxjobs, bool watch)
+{
+    fatal("server mode is not supported on this platform");
+    return 1;
+}
+
+int serve_frames(int maxjobs)
+{
+    fatal("server mode is not supported on this platform");
+    return 1;
+}
+
+int serve_batch(const char *outdir, char **inputs, int ninputs, int maxjobs)
+{
+    fatal("server mode is not supported on this platform");
+    return 1;
+}
+
+#else
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// a job that is currently running
+typedef struct job {
+    pid_t pid;
+    int id;
+    double start;
+    FILE *out;          // framed mode: where the child writes
+    char *name;         // spool mode: job name without extension
+                        // batch mode: output file name
+} Job;
+
+static Job *jobs;
+static int numjobs;
+
+// per-job latencies, for the summary
+static double *latency;
+static int numlatency, maxlatency;
+static int numfailed;
+
+double
+job_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+static char *
+xstrcat3(const char *a, const char *b, const char *c)
+{
+    char *r = xrealloc(NULL, strlen(a) + strlen(b) + strlen(c) + 1);
+    strcpy(r, a); strcat(r, b); strcat(r, c);
+    return r;
+}
+
+//
+// record how long a job took, for the summary
+//
+void
+note_latency(double secs, bool failed)
+{
+    if (numlatency >= maxlatency) {
+        maxlatency = maxlatency ? 2*maxlatency : 1024;
+        latency = xrealloc(latency, maxlatency * sizeof(double));
+    }
+    latency[numlatency++] = secs;
+    if (failed) numfailed++;
+}
+
+//
+// run one job in a child; in and out are file descriptors for
+// the job's input and output
+//
+static void
+start_job(Job *J, int in, int out)
+{
+    pid_t pid;
+
+    J->start = job_clock();
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int rc;
+        dup2(in, 0);
+        dup2(out, 1);
+        close(in);
+        close(out);
+        // not stdio: stdin's buffer may hold what the parent was reading
+        gl_io = io_fd(0, 1);
+        rc = eval_loop(g_root);
+        _exit(rc & 0xff);
+    }
+    J->pid = pid;
+}
+
+//
+// wait for some child to finish and return its slot
+//
+static Job *
+reap_job(int *status)
+{
+    pid_t pid;
+    int i;
+    Job *J;
+
+    for(;;) {
+        pid = waitpid(-1, status, 0);
+        if (pid < 0) {
+            perror("waitpid");
+            exit(1);
+        }
+        for (i = 0; i < numjobs; i++) {
+            if (jobs[i].pid == pid) {
+                J = &jobs[i];
+                note_latency(job_clock() - J->start, !WIFEXITED(*status));
+                return J;
+            }
+        }
+    }
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double
+percentile(double p)
+{
+    int i = (int)(p * (numlatency-1) + 0.5);
+    return latency[i];
+}
+
+void
+report_jobs(double elapsed)
+{
+    if (numlatency == 0) {
+        fprintf(stderr, "no jobs\n");
+        return;
+    }
+    qsort(latency, numlatency, sizeof(double), cmp_double);
+    fprintf(stderr, "%d jobs (%d failed) in %.3fs: %.1f jobs/s\n",
+            numlatency, numfailed, elapsed, numlatency / elapsed);
+    fprintf(stderr, "latency: p50 %.3fms p99 %.3fms max %.3fms\n",
+            percentile(0.50)*1e3, percentile(0.99)*1e3,
+            latency[numlatency-1]*1e3);
+}
+
+static Job *
+alloc_jobs(int maxjobs)
+{
+    jobs = xrealloc(NULL, maxjobs * sizeof(Job));
+    memset(jobs, 0, maxjobs * sizeof(Job));
+    numjobs = maxjobs;
+    return jobs;
+}
+
+//
+// find a free job slot, waiting for a running job if necessary;
+// "finish" is called on each job that completes
+//
+static Job *
+free_slot(int *running, void (*finish)(Job *, int))
+{
+    int i;
+    int status;
+    Job *J;
+
+    if (*running == numjobs) {
+        J = reap_job(&status);
+        (*finish)(J, status);
+        J->pid = 0;
+        --*running;
+    }
+    for (i = 0; i < numjobs; i++) {
+        if (jobs[i].pid == 0) return &jobs[i];
+    }
+    fatal("no free job slot");
+    return NULL;
+}
+
+static void
+drain(int *running, void (*finish)(Job *, int))
+{
+    int status;
+    Job *J;
+
+    while (*running > 0) {
+        J = reap_job(&status);
+        (*finish)(J, status);
+        J->pid = 0;
+        --*running;
+    }
+}
+
+//
+// spool directory mode
+// a job is a file "name.in"; we claim it by renaming it to "name.run",
+// write the output to "name.part", and rename that to "name.out" when
+// the job is finished, or to "name.err" if it crashed or was killed
+// (the exit status of a job that finishes is the program's own)
+//
+static void
+finish_spool(Job *J, int status)
+{
+    char *run = xstrcat3(J->name, ".run", "");
+    char *part = xstrcat3(J->name, ".part", "");
+    char *out = xstrcat3(J->name, WIFEXITED(status) ? ".out" : ".err", "");
+
+    if (rename(part, out) < 0) perror(out);
+    unlink(run);
+    free(run); free(part); free(out);
+    free(J->name);
+    J->name = NULL;
+}
+
+int
+serve_spool(const char *dir, int maxjobs, bool watch)
+{
+    DIR *D;
+    struct dirent *ent;
+    int running = 0;
+    int found;
+    int in, out;
+    size_t len;
+    double start;
+    Job *J;
+    char *name, *run, *part;
+
+    alloc_jobs(maxjobs);
+    start = job_clock();
+    for(;;) {
+        D = opendir(dir);
+        if (!D) {
+            perror(dir);
+            return 1;
+        }
+        found = 0;
+        while ((ent = readdir(D)) != NULL) {
+            len = strlen(ent->d_name);
+            if (len <= 3 || strcmp(ent->d_name + len - 3, ".in") != 0) {
+                continue;
+            }
+            name = xstrcat3(dir, "/", ent->d_name);
+            name[strlen(name) - 3] = 0;
+            run = xstrcat3(name, ".run", "");
+            part = xstrcat3(name, ".part", "");
+            {
+                char *inname = xstrcat3(name, ".in", "");
+                // another server may have claimed it first
+                if (rename(inname, run) < 0) {
+                    free(inname); free(run); free(part); free(name);
+                    continue;
+                }
+                free(inname);
+            }
+            found++;
+            J = free_slot(&running, finish_spool);
+            in = open(run, O_RDONLY);
+            out = open(part, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if (in < 0 || out < 0) {
+                perror(name);
+                exit(1);
+            }
+            J->name = name;
+            start_job(J, in, out);
+            running++;
+            close(in);
+            close(out);
+            free(run); free(part);
+        }
+        closedir(D);
+        if (!found) {
+            if (!watch) break;
+            if (running > 0) {
+                // nothing new to do, so collect a finished job
+                int status;
+                J = reap_job(&status);
+                finish_spool(J, status);
+                J->pid = 0;
+                running--;
+            } else {
+                usleep(10000);
+            }
+        }
+    }
+    drain(&running, finish_spool);
+    report_jobs(job_clock() - start);
+    return 0;
+}
+
+//
+// framed stdin mode
+// each job on stdin is a decimal byte count and a newline, followed
+// by that many bytes of input; each result on stdout is
+// "id status count\n" followed by count bytes of output, where id
+// counts jobs from 0 in the order they were read (results are written
+// as jobs finish, which need not be the same order)
+//
+static unsigned char inbuf[65536];
+static size_t inlen, inpos;
+
+static int
+read_byte(void)
+{
+    ssize_t r;
+    if (inpos >= inlen) {
+        r = read(0, inbuf, sizeof(inbuf));
+        if (r <= 0) return -1;
+        inlen = r;
+        inpos = 0;
+    }
+    return inbuf[inpos++];
+}
+
+void
+write_all(const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t r;
+    while (len > 0) {
+        r = write(1, p, len);
+        if (r <= 0) {
+            perror("write");
+            exit(1);
+        }
+        p += r;
+        len -= r;
+    }
+}
+
+static void
+finish_frame(Job *J, int status)
+{
+    char hdr[64];
+    char buf[8192];
+    long len;
+    size_t n;
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    fflush(J->out);
+    len = ftell(J->out);
+    rewind(J->out);
+    snprintf(hdr, sizeof(hdr), "%d %d %ld\n", J->id, code, len);
+    write_all(hdr, strlen(hdr));
+    while ((n = fread(buf, 1, sizeof(buf), J->out)) > 0) {
+        write_all(buf, n);
+    }
+    fclose(J->out);
+    J->out = NULL;
+}
+
+int
+serve_frames(int maxjobs)
+{
+    int running = 0;
+    int id = 0;
+    int c;
+    long len;
+    double start;
+    FILE *in;
+    Job *J;
+
+    alloc_jobs(maxjobs);
+    start = job_clock();
+    for(;;) {
+        c = read_byte();
+        if (c < 0) break;
+        len = 0;
+        while (c >= '0' && c <= '9') {
+            len = 10*len + (c - '0');
+            c = read_byte();
+        }
+        if (c != '\n') {
+            fprintf(stderr, "bad frame header for job %d\n", id);
+            exit(1);
+        }
+        in = tmpfile();
+        if (!in) {
+            perror("tmpfile");
+            exit(1);
+        }
+        while (len-- > 0) {
+            c = read_byte();
+            if (c < 0) {
+                fprintf(stderr, "short frame for job %d\n", id);
+                exit(1);
+            }
+            putc(c, in);
+        }
+        fflush(in);
+        rewind(in);
+
+        J = free_slot(&running, finish_frame);
+        J->out = tmpfile();
+        if (!J->out) {
+            perror("tmpfile");
+            exit(1);
+        }
+        J->id = id++;
+        start_job(J, fileno(in), fileno(J->out));
+        running++;
+        fclose(in);
+    }
+    drain(&running, finish_frame);
+    report_jobs(job_clock() - start);
+    return 0;
+}
+
+//
+// batch mode
+// run the program on each of a list of input files (or on the files
+// named one per line on stdin, if the list is empty), writing the
+// output for "dir/name" to "outdir/dir/name.out", or to
+// "outdir/dir/name.err" if the job crashes or is killed
+//
+static double batch_inbytes, batch_outbytes;
+
+static void
+finish_batch(Job *J, int status)
+{
+    struct stat st;
+    char *err;
+
+    if (!WIFEXITED(status)) {
+        // keep what it wrote, but not as a result
+        err = xstrcat3(J->name, "", "");
+        strcpy(err + strlen(err) - 4, ".err");
+        if (rename(J->name, err) < 0) perror(err);
+        free(err);
+    } else if (stat(J->name, &st) == 0) {
+        batch_outbytes += st.st_size;
+    }
+    free(J->name);
+    J->name = NULL;
+}
+
+// make the directories on the way to name, those after its first
+// from characters
+static void
+make_parents(char *name, size_t from)
+{
+    char *slash;
+
+    for (slash = strchr(name + from, '/'); slash; slash = strchr(slash + 1, '/')) {
+        if (slash == name) continue;
+        *slash = 0;
+        if (mkdir(name, 0755) < 0 && errno != EEXIST) {
+            perror(name);
+            exit(1);
+        }
+        *slash = '/';
+    }
+}
+
+//
+// the output file for input inname: its path, made relative, under
+// prefix, so that inputs with the same name in different directories
+// don't share one; makes the directories it needs, and returns NULL
+// for a path that would lead out of the output directory
+//
+static char *
+batch_output(const char *prefix, const char *inname)
+{
+    const char *p;
+    char *name;
+
+    while (*inname == '/') inname++;
+    while (inname[0] == '.' && inname[1] == '/') {
+        inname += 2;
+        while (*inname == '/') inname++;
+    }
+    for (p = inname; p; p = strchr(p, '/') ? strchr(p, '/') + 1 : NULL) {
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == 0)) {
+            return NULL;
+        }
+    }
+    name = xstrcat3(prefix, inname, ".out");
+    make_parents(name, strlen(prefix));
+    return name;
+}
+
+// the next input file name, or NULL when there are no more
+static char *
+next_input(char **inputs, int ninputs, int *i)
+{
+    static char *line;
+    static size_t linesize;
+    ssize_t len;
+
+    if (ninputs > 0) {
+        return (*i < ninputs) ? inputs[(*i)++] : NULL;
+    }
+    do {
+        len = getline(&line, &linesize, stdin);
+        if (len < 0) return NULL;
+        if (len > 0 && line[len-1] == '\n') line[--len] = 0;
+    } while (len == 0);
+    return line;
+}
+
+int
+serve_batch(const char *outdir, char **inputs, int ninputs, int maxjobs)
+{
+    int running = 0;
+    int i = 0;
+    int in, out;
+    int bad = 0;
+    double start, elapsed;
+    char *prefix = xstrcat3(outdir, "/", "");
+    char *inname, *outname;
+    struct stat st;
+    Job *J;
+
+    // before any worker tries to write there
+    make_parents(prefix, 0);
+    alloc_jobs(maxjobs);
+    start = job_clock();
+    while ((inname = next_input(inputs, ninputs, &i)) != NULL) {
+        outname = batch_output(prefix, inname);
+        if (!outname) {
+            fprintf(stderr, "%s: can't have its output under %s\n", inname, outdir);
+            bad++;
+            continue;
+        }
+        in = open(inname, O_RDONLY);
+        if (in < 0) {
+            perror(inname);
+            free(outname);
+            bad++;
+            continue;
+        }
+        if (fstat(in, &st) == 0) {
+            batch_inbytes += st.st_size;
+        }
+        J = free_slot(&running, finish_batch);
+        J->name = outname;
+        out = open(J->name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (out < 0) {
+            perror(J->name);
+            exit(1);
+        }
+        start_job(J, in, out);
+        running++;
+        close(in);
+        close(out);
+    }
+    drain(&running, finish_batch);
+    elapsed = job_clock() - start;
+    report_jobs(elapsed);
+    if (numlatency > 0) {
+        fprintf(stderr, "input %.0f bytes (%.0f bytes/s), output %.0f bytes (%.0f bytes/s)\n",
+                batch_inbytes, batch_inbytes / elapsed,
+                batch_outbytes, batch_outbytes / elapsed);
+    }
+    free(prefix);
+    return (bad || numfailed) ? 1 : 0;
+}
+
+#endif
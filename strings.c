@@ -0,0 +1,550 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// packed strings
+//
+// Programs carry their text as lists of Church numerals, built from
+// conses of the form ``s``si`k<car>`k<cdr> (or `c`, or the same
+// thing after evaluation), each taking a dozen or more cells and as
+// many reductions to walk. Before the program runs we look for
+// constant lists of byte sized numerals, and turn the first cons of
+// each into a function cell (Str_func) whose argument is a number:
+// the offset of the text in a byte buffer. When such a cell is
+// applied it turns itself into an ordinary C2 cons of the byte and
+// the rest of the string, so a string only costs cells as far as the
+// program actually looks at it. eval_loop writes out a string it
+// finds at the head of the output directly (put_string).
+//
+// A list ends at its first element that isn't a byte (the
+// terminator, or anything we can't evaluate) or at a cdr that isn't
+// a cons; that cons is kept as the tail of the string.
+//
+// Numerals are evaluated with an opaque successor and zero, and a
+// small budget of reductions, on a copy of the application; the
+// numeral itself just ends up a little more evaluated.
+//
+// The tables (and their gc roots) are for one program, and are kept
+// for as long as the process runs. Only the first program loaded is
+// packed: the scheduler parses a copy of the program for every job,
+// and those copies are left as plain lists rather than piling up.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "lazy.h"
+
+// shortest list worth packing
+#define MIN_STRING 4
+// reductions we will spend on any one numeral
+#define NUMERAL_STEPS 5000
+// and the most cells we will look at to see if it is safe to try
+#define NUMERAL_CELLS 2000
+
+typedef struct packed {
+    unsigned start, end;    // the text is str_bytes[start..end-1]
+} Packed;
+
+typedef struct carvalue {
+    Cell *car;
+    int value;
+} CarValue;
+
+static unsigned char *str_bytes;
+static unsigned str_len, str_max;
+
+static Packed *packed;
+static int numpacked, maxpacked;
+
+//
+// the gc roots we need; a cell for each byte value, then the cars
+// we are evaluating, the numbers and tails of the strings, and the
+// successor and zero the numerals are applied to
+//
+static Cell **roots;
+static Cell **byte_cells;
+static Cell **cars;
+static CarValue *values;
+static int numcars;
+static Cell **nums;
+static int maxstrings;
+static Cell **tails;
+static Cell *succ_cell, *zero_cell;
+
+static bool *seen;
+static Cell **todo;
+static int numtodo, maxtodo;
+
+static void *
+xrealloc(void *p, size_t n)
+{
+    p = realloc(p, n);
+    if (!p) fatal("out of memory");
+    return p;
+}
+
+static void
+push_todo(Cell *c)
+{
+    if (!c || seen[c - mem]) return;
+    seen[c - mem] = true;
+    if (numtodo == maxtodo) {
+        maxtodo = maxtodo ? 2 * maxtodo : 1024;
+        todo = xrealloc(todo, maxtodo * sizeof(Cell *));
+    }
+    todo[numtodo++] = c;
+}
+
+static void
+push_children(Cell *c)
+{
+    switch (gettype(c)) {
+    case CT_A_PAIR:
+    case CT_S2_PAIR:
+    case CT_C2_PAIR:
+    case CT_NUM_PAIR:
+        push_todo(getleft(c));
+        push_todo(getright(c));
+        break;
+    case CT_FUNC:
+        push_todo(getarg(c));
+        break;
+    default:
+        break;
+    }
+}
+
+//
+// recognising conses
+//
+static bool
+is_func(Cell *c, CellFunc *f)
+{
+    return gettype(c) == CT_FUNC && getfunc(c) == f && !getarg(c);
+}
+
+// is c (K x)?
+static bool
+match_K(Cell *c, Cell **x)
+{
+    if (gettype(c) == CT_FUNC && getfunc(c) == K1_func) {
+        *x = getarg(c);
+        return true;
+    }
+    if (gettype(c) == CT_A_PAIR && is_func(getleft(c), K_func)) {
+        *x = getright(c);
+        return true;
+    }
+    return false;
+}
+
+// is c ((S a) b)?
+static bool
+match_S(Cell *c, Cell **a, Cell **b)
+{
+    Cell *f;
+
+    if (gettype(c) == CT_S2_PAIR) {
+        *a = getleft(c);
+        *b = getright(c);
+        return true;
+    }
+    if (gettype(c) != CT_A_PAIR) return false;
+    f = getleft(c);
+    *b = getright(c);
+    if (gettype(f) == CT_FUNC && getfunc(f) == S1_func) {
+        *a = getarg(f);
+        return true;
+    }
+    if (gettype(f) == CT_A_PAIR && is_func(getleft(f), S_func)) {
+        *a = getright(f);
+        return true;
+    }
+    return false;
+}
+
+static bool
+match_cons(Cell *c, Cell **car, Cell **cdr)
+{
+    Cell *a, *b, *i;
+
+    if (gettype(c) == CT_C2_PAIR) {
+        *car = getleft(c);
+        *cdr = getright(c);
+        return true;
+    }
+    if (gettype(c) == CT_A_PAIR) {
+        a = getleft(c);
+        if (gettype(a) == CT_FUNC && getfunc(a) == C1_func) {
+            *car = getarg(a);
+            *cdr = getright(c);
+            return true;
+        }
+        if (gettype(a) == CT_A_PAIR && is_func(getleft(a), C_func)) {
+            *car = getright(a);
+            *cdr = getright(c);
+            return true;
+        }
+    }
+    // ``s``si`k<car>`k<cdr>
+    return match_S(c, &a, &b) && match_K(b, cdr)
+        && match_S(a, &i, &b) && gettype(i) == CT_NUM && getnum(i) == 1
+        && match_K(b, car);
+}
+
+//
+// evaluating numerals
+//
+static jmp_buf numeral_out;
+static unsigned long succs;
+
+static Cell *
+force(Cell *c)
+{
+    while (gettype(c) == CT_A_PAIR) {
+        push_root(c);
+        c = partial_eval(c);
+        pop_root();
+    }
+    return c;
+}
+
+static void
+out_of_fuel(void)
+{
+    longjmp(numeral_out, 1);
+}
+
+static Cell *
+Zero_func(Cell *r, Cell *self, Cell *rhs)
+{
+    longjmp(numeral_out, 1);
+    return r;
+}
+
+static Cell *
+Succ_func(Cell *r, Cell *self, Cell *rhs)
+{
+    if (force(rhs) != zero_cell) {
+        longjmp(numeral_out, 1);
+    }
+    succs++;
+    return zero_cell;
+}
+
+// is c small, and free of Inc and Read, which we mustn't run?
+static bool
+safe_to_try(Cell *c, int *budget)
+{
+    for (; c; c = getright(c)) {
+        if (--*budget < 0) return false;
+        switch (gettype(c)) {
+        case CT_A_PAIR:
+        case CT_S2_PAIR:
+        case CT_C2_PAIR:
+        case CT_NUM_PAIR:
+            if (!safe_to_try(getleft(c), budget)) return false;
+            break;
+        case CT_FUNC:
+            if (getfunc(c) == Inc_func || getfunc(c) == Read_func) return false;
+            if (getfunc(c) == Str_func) return false;
+            return getarg(c) ? safe_to_try(getarg(c), budget) : true;
+        case CT_NUM:
+            return true;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+// the value of numeral n, or -1 if it isn't one we can work out
+static int
+numeral_value(Cell *n)
+{
+    Cell *a1, *a2;
+    int budget = NUMERAL_CELLS;
+    int saved_top = root_stack_top;
+    unsigned long saved_reductions = gl_reductions;
+    unsigned long saved_end = gl_slice_end;
+    void (*saved_hook)(void) = gl_slice_hook;
+    volatile int v = -1;
+
+    if (gettype(n) == CT_NUM) return getnum(n);
+    if (!safe_to_try(n, &budget)) return -1;
+    a2 = alloc_cell();
+    mkapply(a2, n, succ_cell);
+    push_root(a2);
+    a1 = alloc_cell();
+    pop_root();
+    mkapply(a1, a2, zero_cell);
+
+    succs = 0;
+    gl_slice_end = gl_reductions + NUMERAL_STEPS;
+    gl_slice_hook = out_of_fuel;
+    if (setjmp(numeral_out) == 0) {
+        if (force(a1) == zero_cell) v = succs;
+    }
+    root_stack_top = saved_top;
+    gl_reductions = saved_reductions;
+    gl_slice_end = saved_end;
+    gl_slice_hook = saved_hook;
+    return v;
+}
+
+static int
+cmp_car(const void *a, const void *b)
+{
+    const CarValue *x = a, *y = b;
+
+    return (x->car > y->car) - (x->car < y->car);
+}
+
+// the value of a car we looked at before, or -1
+static int
+value_of(Cell *c)
+{
+    CarValue key, *found;
+
+    if (gettype(c) == CT_NUM) return getnum(c);
+    key.car = c;
+    found = bsearch(&key, values, numcars, sizeof(CarValue), cmp_car);
+    return found ? found->value : -1;
+}
+
+//
+// pack the list starting at cons c, if it's long enough
+//
+static void
+pack(Cell *c)
+{
+    Cell *car, *cdr, *p;
+    unsigned n = 0;
+    int v;
+    Packed *P;
+
+    for (p = c; match_cons(p, &car, &cdr); p = cdr) {
+        v = value_of(car);
+        if (v < 0 || v > 255) break;
+        if (++n > MIN_STRING) break;
+    }
+    if (n < MIN_STRING || numpacked == maxstrings) {
+        push_children(c);
+        return;
+    }
+    if (numpacked == maxpacked) {
+        maxpacked = maxpacked ? 2 * maxpacked : 256;
+        packed = xrealloc(packed, maxpacked * sizeof(Packed));
+    }
+    P = &packed[numpacked];
+    P->start = str_len;
+    for (p = c; match_cons(p, &car, &cdr); p = cdr) {
+        v = value_of(car);
+        if (v < 0 || v > 255) break;
+        if (str_len == str_max) {
+            str_max = str_max ? 2 * str_max : 4096;
+            str_bytes = xrealloc(str_bytes, str_max);
+        }
+        str_bytes[str_len++] = v;
+        // the rest of the list is part of this string
+        seen[cdr - mem] = true;
+    }
+    P->end = str_len;
+    tails[numpacked] = p;
+    setshared(p);
+    seen[p - mem] = false;
+    push_todo(p);
+    mknum(nums[numpacked], P->start);
+    mkfunc(c, Str_func, nums[numpacked]);
+    numpacked++;
+}
+
+int
+pack_strings(Cell *prog)
+{
+    Cell *c, *car, *cdr;
+    int numcons = 0;
+    int i, n;
+    static bool done;
+
+    if (done) return 0;
+    done = true;
+    seen = calloc(NUMCELLS, sizeof(bool));
+    if (!seen) fatal("out of memory");
+
+    // find the cons cells, and the cars that need evaluating
+    numcars = 0;
+    push_todo(prog);
+    while (numtodo > 0) {
+        c = todo[--numtodo];
+        if (match_cons(c, &car, &cdr)) {
+            numcons++;
+            if (gettype(car) != CT_NUM) numcars++;
+        }
+        push_children(c);
+    }
+    if (numcons == 0) {
+        free(seen);
+        return 0;
+    }
+
+    n = 256 + numcars + 2 * numcons + 2;
+    roots = xrealloc(NULL, n * sizeof(Cell *));
+    for (i = 0; i < n; i++) roots[i] = NULL;
+    byte_cells = roots;
+    cars = roots + 256;
+    nums = cars + numcars;
+    tails = nums + numcons;
+    maxstrings = numcons;
+    values = xrealloc(NULL, (numcars + 1) * sizeof(CarValue));
+    add_roots(roots, n);
+
+    memset(seen, 0, NUMCELLS * sizeof(bool));
+    numcars = 0;
+    push_todo(prog);
+    while (numtodo > 0) {
+        c = todo[--numtodo];
+        if (match_cons(c, &car, &cdr) && gettype(car) != CT_NUM) {
+            cars[numcars++] = car;
+        }
+        push_children(c);
+    }
+
+    // everything from here on may cause a gc
+    push_root(prog);
+    for (i = 0; i < 256; i++) {
+        byte_cells[i] = alloc_cell();
+        mknum(byte_cells[i], i);
+        setshared(byte_cells[i]);
+    }
+    for (i = 0; i < numcons; i++) {
+        nums[i] = alloc_cell();
+        mknum(nums[i], 0);
+    }
+    succ_cell = roots[n-2] = alloc_cell();
+    mkfunc(succ_cell, Succ_func, NULL);
+    setshared(succ_cell);
+    zero_cell = roots[n-1] = alloc_cell();
+    mkfunc(zero_cell, Zero_func, NULL);
+    setshared(zero_cell);
+    for (i = 0; i < numcars; i++) {
+        values[i].value = numeral_value(cars[i]);
+    }
+
+    // and now no more allocation: the graph stays just as it is
+    // while we pack the strings
+    prog = pop_root();
+    for (i = 0; i < numcars; i++) {
+        values[i].car = cars[i];
+        cars[i] = NULL;
+    }
+    qsort(values, numcars, sizeof(CarValue), cmp_car);
+    memset(seen, 0, NUMCELLS * sizeof(bool));
+    push_todo(prog);
+    while (numtodo > 0) {
+        c = todo[--numtodo];
+        if (match_cons(c, &car, &cdr)) {
+            pack(c);
+        } else {
+            push_children(c);
+        }
+    }
+    free(seen);
+    free(values);
+
+    // let go of everything the strings don't need
+    for (i = numpacked; i < numcons; i++) nums[i] = NULL;
+    roots[n-2] = roots[n-1] = NULL;
+    return numpacked;
+}
+
+static Packed *
+find_packed(unsigned off)
+{
+    int lo = 0, hi = numpacked - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (packed[mid].start <= off) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return &packed[lo];
+}
+
+//
+// a packed string applied to f becomes a cons of its first byte and
+// the rest, which is applied to f as usual
+//
+Cell *
+Str_func(Cell *r, Cell *self, Cell *f)
+{
+    unsigned off = getnum(getarg(self));
+    Packed *P = find_packed(off);
+    bool more = off + 1 < P->end;
+    // a frozen string can't be expanded in place
+    bool frozen = self < frozen_end;
+    Cell *cells[3];
+    Cell *rest;
+    int n = (more ? 2 : 0) + (frozen ? 1 : 0);
+
+    if (n > 0) {
+        alloc_cells(cells, n);
+    }
+    if (more) {
+        mknum(cells[1], off + 1);
+        mkfunc(cells[0], Str_func, cells[1]);
+        rest = cells[0];
+    } else {
+        rest = tails[P - packed];
+    }
+    if (frozen) {
+        self = cells[n-1];
+    }
+    mkc2(self, byte_cells[str_bytes[off]], rest);
+    return apply_C2(r, self, f);
+}
+
+//
+// write out the packed string s, and return the rest of the list
+//
+Cell *
+put_string(Cell *s)
+{
+    unsigned off = getnum(getarg(s));
+    Packed *P = find_packed(off);
+
+    for (; off < P->end; off++) {
+        putch(str_bytes[off]);
+    }
+    return tails[P - packed];
+}
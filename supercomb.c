@@ -0,0 +1,380 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+//
+// supercombinator extraction (see supercomb.h)
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "lazy.h"
+#include "supercomb.h"
+
+//
+// symbolic terms are allocated in chunks, and only freed all at once
+// by sc_release: the tools that build them run once and exit, but the
+// interpreter looks at every program it loads (knot.c), and throws
+// away what it built for each function as soon as it is done with it
+//
+#define STERM_CHUNK 1024
+
+typedef struct stermchunk {
+    struct stermchunk *prev;
+    int used;
+    STerm terms[STERM_CHUNK];
+} STermChunk;
+
+static STermChunk *chunks;
+static size_t numsterms;
+
+static STerm *
+new_sterm(STermKind kind)
+{
+    STermChunk *c;
+    STerm *t;
+
+    if (!chunks || chunks->used == STERM_CHUNK) {
+        c = malloc(sizeof(STermChunk));
+        if (!c) fatal("out of memory");
+        c->prev = chunks;
+        c->used = 0;
+        chunks = c;
+    }
+    t = &chunks->terms[chunks->used++];
+    numsterms++;
+    memset(t, 0, sizeof(*t));
+    t->kind = kind;
+    return t;
+}
+
+size_t
+sc_mark(void)
+{
+    return numsterms;
+}
+
+void
+sc_release(size_t mark)
+{
+    STermChunk *c;
+
+    while (chunks && numsterms - chunks->used >= mark) {
+        c = chunks;
+        numsterms -= c->used;
+        chunks = c->prev;
+        free(c);
+    }
+    if (chunks) {
+        chunks->used -= numsterms - mark;
+        numsterms = mark;
+    }
+}
+
+static STerm *
+mk_var(int n)
+{
+    STerm *t = new_sterm(ST_VAR);
+    t->var = n;
+    t->hasvar = true;
+    return t;
+}
+
+static STerm *
+mk_cell(Cell *c)
+{
+    STerm *t = new_sterm(ST_CELL);
+    t->cell = c;
+    return t;
+}
+
+static STerm *
+mk_app(STerm *f, STerm *x)
+{
+    STerm *t = new_sterm(ST_APP);
+    t->fun = f;
+    t->arg = x;
+    t->hasvar = f->hasvar || x->hasvar;
+    return t;
+}
+
+//
+// number of arguments the head "h" needs before it can be reduced,
+// or 0 if it is stuck
+//
+static int
+needed_args(Cell *c)
+{
+    CellFunc *f;
+
+    switch (gettype(c)) {
+    case CT_S2_PAIR:
+    case CT_C2_PAIR:
+        return 1;
+    case CT_NUM:
+        if (getnum(c) == 0) return 2;
+        if (getnum(c) == 1) return 1;
+        return 0;
+    case CT_FUNC:
+        f = getfunc(c);
+        if (f == K_func || f == KI_func || f == S1_func || f == C1_func) return 2;
+        if (f == S_func || f == C_func) return 3;
+        if (f == K1_func) return 1;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+//
+// apply head c to arguments x, y, z (as many as it needs)
+//
+static STerm *
+reduce(Cell *c, STerm *x, STerm *y, STerm *z)
+{
+    CellFunc *f;
+    STerm *a, *b;
+
+    switch (gettype(c)) {
+    case CT_S2_PAIR:
+        // ``s a b x -> `ax`bx
+        a = mk_cell(getleft(c));
+        b = mk_cell(getright(c));
+        return mk_app(mk_app(a, x), mk_app(b, x));
+    case CT_C2_PAIR:
+        // ``c a b x -> ``xab
+        a = mk_cell(getleft(c));
+        b = mk_cell(getright(c));
+        return mk_app(mk_app(x, a), b);
+    case CT_NUM:
+        return getnum(c) == 0 ? y : x;
+    case CT_FUNC:
+        f = getfunc(c);
+        if (f == K_func) return x;
+        if (f == KI_func) return y;
+        if (f == K1_func) return mk_cell(getarg(c));
+        if (f == S_func) return mk_app(mk_app(x, z), mk_app(y, z));
+        if (f == S1_func) {
+            a = mk_cell(getarg(c));
+            return mk_app(mk_app(a, y), mk_app(x, y));
+        }
+        if (f == C_func) return mk_app(mk_app(z, x), y);
+        if (f == C1_func) {
+            a = mk_cell(getarg(c));
+            return mk_app(mk_app(y, a), x);
+        }
+        break;
+    default:
+        break;
+    }
+    fatal("supercomb: bad reduction");
+    return NULL;
+}
+
+//
+// reduce the parts of t that mention variables as far as they go:
+// the head until it is stuck (a variable, a primitive, or something
+// still waiting for arguments), then each of its arguments in turn
+//
+static STerm *
+normalise(STerm *t, int *budget, int depth)
+{
+    STerm *args[SC_NORM_MAX_ARGS];
+    int sp = 0;
+    int need;
+    int i;
+    STerm *h, *a;
+    STerm *x, *y, *z;
+    Cell *c;
+
+    if (!t->hasvar) return t;
+    if (depth > SC_NORM_MAX_DEPTH || --*budget < 0) return NULL;
+    h = t;
+    for(;;) {
+        if (h->kind == ST_APP) {
+            if (sp >= SC_NORM_MAX_ARGS) return NULL;
+            args[sp++] = h->arg;
+            h = h->fun;
+            continue;
+        }
+        if (h->kind == ST_VAR) break;
+        c = h->cell;
+        if (gettype(c) == CT_A_PAIR) {
+            if (sp >= SC_NORM_MAX_ARGS) return NULL;
+            args[sp++] = mk_cell(getright(c));
+            h = mk_cell(getleft(c));
+            continue;
+        }
+        need = needed_args(c);
+        if (need == 0 || sp < need) break;
+        if (--*budget < 0) return NULL;
+        x = args[sp-1];
+        y = need > 1 ? args[sp-2] : NULL;
+        z = need > 2 ? args[sp-3] : NULL;
+        sp -= need;
+        h = reduce(c, x, y, z);
+    }
+    for (i = sp-1; i >= 0; --i) {
+        a = normalise(args[i], budget, depth + 1);
+        if (!a) return NULL;
+        h = mk_app(h, a);
+    }
+    return h;
+}
+
+STerm *
+sc_normalise(STerm *t, int budget)
+{
+    return normalise(t, &budget, 0);
+}
+
+//
+// walkers; each walk visits shared subterms only once
+//
+static int walk_gen;
+
+static int
+body_size(STerm *t)
+{
+    // count the distinct applications that mention variables
+    if (t->kind != ST_APP || !t->hasvar || t->mark == walk_gen) return 0;
+    t->mark = walk_gen;
+    return 1 + body_size(t->fun) + body_size(t->arg);
+}
+
+static bool
+extract(Cell *T, Supercomb *out)
+{
+    // args[sp-1] is the first argument of the current head
+    STerm *args[SC_MAX_ARITY + 3*SC_MAX_STEPS + 8];
+    int maxargs = sizeof(args)/sizeof(args[0]);
+    int sp = 0;
+    int nvars = 0;
+    int steps = 0;
+    int need;
+    int i;
+    STerm *h;
+    STerm *x, *y, *z;
+    Cell *c;
+
+    h = mk_cell(T);
+    for(;;) {
+        if (h->kind == ST_APP) {
+            if (sp >= maxargs) return false;
+            args[sp++] = h->arg;
+            h = h->fun;
+            continue;
+        }
+        if (h->kind == ST_VAR) break;
+        c = h->cell;
+        if (gettype(c) == CT_A_PAIR) {
+            if (sp >= maxargs) return false;
+            args[sp++] = mk_cell(getright(c));
+            h = mk_cell(getleft(c));
+            continue;
+        }
+        need = needed_args(c);
+        if (need == 0) break;
+        // supply fresh variables for any missing arguments; they
+        // go after the ones we already have
+        while (sp < need) {
+            if (nvars >= SC_MAX_ARITY) return false;
+            memmove(&args[1], &args[0], sp * sizeof(args[0]));
+            args[0] = mk_var(nvars++);
+            sp++;
+        }
+        if (++steps > SC_MAX_STEPS) return false;
+        x = args[sp-1];
+        y = need > 1 ? args[sp-2] : NULL;
+        z = need > 2 ? args[sp-3] : NULL;
+        sp -= need;
+        h = reduce(c, x, y, z);
+    }
+    for (i = sp-1; i >= 0; --i) {
+        h = mk_app(h, args[i]);
+    }
+    if (nvars == 0 || steps == 0) return false;
+    walk_gen++;
+    out->cell = T;
+    out->arity = nvars;
+    out->steps = steps;
+    out->size = body_size(h);
+    out->body = h;
+    return true;
+}
+
+bool
+sc_extract(Cell *T, Supercomb *out)
+{
+    if (gettype(T) != CT_A_PAIR) return false;
+    return extract(T, out) && out->size <= SC_MAX_SIZE;
+}
+
+bool
+sc_apply(Cell *T, Supercomb *out)
+{
+    return extract(T, out);
+}
+
+static void
+walk_body(STerm *t, STermVisit fn, void *arg)
+{
+    if (t->kind != ST_APP || !t->hasvar) return;
+    if (t->mark == walk_gen) return;
+    t->mark = walk_gen;
+    walk_body(t->fun, fn, arg);
+    walk_body(t->arg, fn, arg);
+    (*fn)(t, arg);
+}
+
+void
+sc_walk_body(STerm *body, STermVisit fn, void *arg)
+{
+    walk_gen++;
+    walk_body(body, fn, arg);
+}
+
+static void
+walk_consts(STerm *t, STermVisit fn, void *arg)
+{
+    if (t->kind == ST_VAR) return;
+    if (t->mark == walk_gen) return;
+    t->mark = walk_gen;
+    if (t->kind == ST_APP) {
+        walk_consts(t->fun, fn, arg);
+        walk_consts(t->arg, fn, arg);
+        if (t->hasvar) return;
+    }
+    (*fn)(t, arg);
+}
+
+void
+sc_walk_consts(STerm *body, STermVisit fn, void *arg)
+{
+    walk_gen++;
+    walk_consts(body, fn, arg);
+}
@@ -0,0 +1,96 @@
+/* Lazy K Interpreter/Compiler
+ *
+ * Copyright 2015 Total Spectrum Software Inc.
+ *
+ * +--------------------------------------------------------------------
+ * ¦  TERMS OF USE: MIT License
+ * +--------------------------------------------------------------------
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * +--------------------------------------------------------------------
+ */
+
+#ifndef SUPERCOMB_H
+#define SUPERCOMB_H
+//
+// symbolic terms, used to find the supercombinators hiding in a
+// combinator graph: a closed subterm T is applied to fresh variables
+// v0, v1, ... and head-reduced at compile time until it gets stuck;
+// if it gets stuck on a variable (or some other primitive) we have
+//   T v0 ... vn-1 = body
+// and T can be replaced by code that builds "body" directly once it
+// has been given all n arguments
+//
+typedef enum STermKind {
+    ST_VAR,     // argument number "var"
+    ST_CELL,    // a cell of the original graph
+    ST_APP,     // application of fun to arg
+} STermKind;
+
+typedef struct sterm STerm;
+
+struct sterm {
+    STermKind kind;
+    int var;
+    Cell *cell;
+    STerm *fun, *arg;
+    bool hasvar;    // true if the term mentions any variable
+    int mark;       // used by the walkers
+    int id;         // free for use by the code generators
+};
+
+typedef struct supercomb {
+    Cell *cell;     // the subterm this replaces
+    int arity;
+    int steps;      // compile-time reductions it took
+    int size;       // applications in the body that mention variables
+    STerm *body;
+} Supercomb;
+
+// limits on what we are willing to compile
+#define SC_MAX_ARITY 8
+#define SC_MAX_STEPS 1000
+#define SC_MAX_SIZE 16
+
+bool sc_extract(Cell *T, Supercomb *out);
+
+// the same for any closed term T, not just an application, and with
+// no limit on the size of the body; only for looking at
+bool sc_apply(Cell *T, Supercomb *out);
+
+// reduce a body further, inside the arguments as well as at the
+// head, taking at most budget steps (NULL if that isn't enough)
+#define SC_NORM_MAX_ARGS 256
+#define SC_NORM_MAX_DEPTH 1000
+STerm *sc_normalise(STerm *body, int budget);
+
+// walk all the applications of a body that mention variables, in
+// an order where every application comes after its subterms
+typedef void (*STermVisit)(STerm *t, void *arg);
+void sc_walk_body(STerm *body, STermVisit fn, void *arg);
+
+// walk the parts of a body that do not mention variables: the cells
+// of the original graph and the constant applications built from them
+void sc_walk_consts(STerm *body, STermVisit fn, void *arg);
+
+// free every term made since sc_mark returned mark
+size_t sc_mark(void);
+void sc_release(size_t mark);
+
+#endif